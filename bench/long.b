@@ -0,0 +1,17 @@
+>+>+>+>+>++<[>[<+++>-
+ >>>>>
+ >+>+>+>+>++<[>[<+++>-
+   >>>>>
+   >+>+>+>+>++<[>[<+++>-
+     >>>>>
+     >+>+>+>+>++<[>[<+++>-
+       >>>>>
+       +++[->+++++<]>[-]<
+       <<<<<
+     ]<<]>[-]
+     <<<<<
+   ]<<]>[-]
+   <<<<<
+ ]<<]>[-]
+ <<<<<
+]<<]>.
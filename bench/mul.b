@@ -0,0 +1,9 @@
+Runs a multiplication loop with four targets 8000000 times
+
+>>>>++++++++++[<<<<++++++++++++++++++++>>>>-]<<<<
+[>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ [>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+  [>+++++[->+>++>+++>----<<<<]>[-]>[-]>[-]>[-]<<<<<-]
+ <-]
+<-]
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
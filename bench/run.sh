@@ -0,0 +1,91 @@
+#!/bin/bash
+
+## Simple BrainFuck Interpreter benchmarks -- see README.md ##
+
+#
+# Builds sbfi, runs each program of this directory in each configuration
+# and prints the best wall time, the number of instructions dispatched by
+# the interpreter and the number of instructions per second.
+#
+# Usage: bench/run.sh [-r runs] [-s file] [-c file] [-o 'options;...'] [programs...]
+#
+#   -r runs     how many times each benchmark is run, the best time is kept (default : 3)
+#   -s file     save the times in file, to compare with them later
+#   -c file     compare the times with the ones saved in file
+#   -o options  the configurations to run, separated by ';' (default : every
+#               cell size with NONE, then every memory behavior with 8 bits cells)
+#
+# A program NAME.b reads its input from NAME.in if it exists. Its output
+# is checked against NAME.out with 8 bits cells, since the wider cells
+# can legitimately change it. CC and CFLAGS choose how sbfi is built.
+#
+
+cd "$(dirname "$0")" || exit 1
+
+RUNS=3
+SAVE=
+COMPARE=
+OPTIONS='--cell=8;--cell=16;--cell=32;--cell=64;--memory=extend;--memory=abort;--memory=wrap;--memory=block;--memory=extend --guard-pages;--jit'
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O3 -march=native}
+
+while getopts 'r:s:c:o:' opt; do
+    case $opt in
+        r) RUNS=$OPTARG ;;
+        s) SAVE=$OPTARG ;;
+        c) COMPARE=$OPTARG ;;
+        o) OPTIONS=$OPTARG ;;
+        *) sed -n '/^# Usage/,/^$/p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+programs=("$@")
+[ ${#programs[@]} -eq 0 ] && programs=(*.b)
+IFS=';' read -ra configs <<< "$OPTIONS"
+
+# The profiler counts the instructions, but slows the interpreter down,
+# so the times come from a normal build and the counts from a PROFILE one.
+
+BUILD=$(mktemp -d) || exit 1
+trap 'rm -rf "$BUILD"' EXIT
+cp ../sbfi.c ../*.h "$BUILD" || exit 1
+$CC $CFLAGS "$BUILD/sbfi.c" -o "$BUILD/sbfi" || exit 1
+sed 's/^#define PROFILE .*/#define PROFILE             1/' ../sbfi.c > "$BUILD/profile.c"
+$CC $CFLAGS "$BUILD/profile.c" -o "$BUILD/profile" || exit 1
+[ -n "$SAVE" ] && : > "$SAVE"
+
+printf '%-12s %-28s %10s %16s %12s %16s\n' program options ms instructions 'Minstr/s' baseline
+
+for program in "${programs[@]}"; do
+    name=${program%.b}
+    input=/dev/null
+    [ -f "$name.in" ] && input=$name.in
+    for options in "${configs[@]}"; do
+        best=
+        for ((run = 0; run < RUNS; ++run)); do
+            start=$(date +%s%N)
+            "$BUILD/sbfi" $options "$program" < "$input" > "$BUILD/out" 2> /dev/null
+            end=$(date +%s%N)
+            ms=$(( (end - start) / 1000000 ))
+            [ -z "$best" ] || [ "$ms" -lt "$best" ] && best=$ms
+        done
+
+        # --jit is left out of the count, the instructions are the same as interpreted
+
+        count=$("$BUILD/profile" --profile ${options/--jit/} "$program" < "$input" 2>&1 > /dev/null \
+            | sed -n 's/^Profile : \([0-9]*\) instructions executed$/\1/p')
+        [ "$best" -gt 0 ] || best=1
+        rate=-
+        [ -n "$count" ] && rate=$(awk "BEGIN { printf \"%.1f\", $count / $best / 1000 }")
+        baseline=-
+        [ -n "$COMPARE" ] && baseline=$(awk -F '\t' -v p="$name" -v o="$options" '$1 == p && $2 == o { print $3 }' "$COMPARE")
+        [ -n "$baseline" ] && [ "$baseline" != - ] && baseline="$baseline ($(awk "BEGIN { printf \"%.2fx\", $baseline / $best }"))"
+
+        status=
+        if [ -f "$name.out" ] && [[ "$options" != *--cell=* || "$options" == *--cell=8* ]] && ! cmp -s "$BUILD/out" "$name.out"; then
+            status='  WRONG OUTPUT'
+        fi
+        printf '%-12s %-28s %10s %16s %12s %16s%s\n' "$name" "$options" "$best" "${count:--}" "$rate" "${baseline:--}" "$status"
+        [ -n "$SAVE" ] && printf '%s\t%s\t%s\n' "$name" "$options" "$best" >> "$SAVE"
+    done
+done
@@ -0,0 +1,331 @@
+/** Simple BrainFuck Interpreter V3.2 -- Written by Maxime Rinoldo **/
+
+/*
+ * This file is included by sbfi.c once for each cell size, with CELL
+ * defined as the type of a cell and CELL_NAME as its number of bits.
+ * It defines the functions that depend on the type of the cells, then
+ * includes exec.h once for each memory behavior, so that every
+ * combination gets its own exec_prog. The one matching the settings
+ * is chosen once at startup, thus the settings cost nothing while
+ * the program runs.
+ */
+
+#define CELL_FN(name) JOIN(name, CELL_NAME)
+
+// The product of a cell and a factor, wrapped like the cells (a uint16_t alone would be promoted to an int, which can overflow)
+
+#define CELL_MUL(value, factor) ((CELL)((uint64_t)(value) * (uint64_t)(int64_t)(factor)))
+
+/*
+ * The following functions implement different behaviors
+ * regarding the checking of the cell array bounds. Each
+ * specialized exec_prog only uses the one matching its
+ * memory behavior, in order to not burden the program.
+ *
+ * If the Brainfuck program tries to access cells outside
+ * the cell array, the interpreter can EXTEND the array,
+ * WRAP to the other end, BLOCK the pointer movement at
+ * the bound, or ABORT the program.
+ *
+ * If NONE of these settings is enabled, the interpreter
+ * will be faster since it won't do any checking. If the
+ * program tries to access a cell outside the array, the
+ * behavior is undefined (the program may or may not crash
+ * or behave unexpectedly).
+ *
+ * As for the details of the memory behavior functions,
+ * it's entirely pointer arithmetic, AKA magic.
+ */
+
+/*
+ * With EXTEND, the array is a paged tape (see tape_page), and ptr0 is
+ * the beginning of the page the pointer is in. exec_prog moves the
+ * pointer inside its page by itself, and only calls extend_memory
+ * when it leaves it, to look the new page up.
+ */
+
+static CELL *CELL_FN(extend_memory)(t_tape *tape, long *page, CELL **ptr0, CELL *ptr, int shift)
+{
+    long pos = *page * TAPE_PAGE_CELLS + (ptr - *ptr0) + shift;
+
+    *page = pos >> TAPE_PAGE_BITS;
+    *ptr0 = tape_page(tape, *page);
+    return (*ptr0 + (pos & (TAPE_PAGE_CELLS - 1)));
+}
+
+// abort_memory returns a status instead of raising the error, so that exec_prog can free the array first
+
+static int CELL_FN(abort_memory)(CELL *ptr0, CELL **ptr, size_t size, int shift)
+{
+    if (*ptr + shift >= ptr0 + size || *ptr + shift < ptr0)
+        return (fail(SBFI_ERROR_MEMORY, ERROR_MEMORY, (long)(*ptr - ptr0 + shift), (long)size - 1));
+    *ptr += shift;
+    return (SBFI_OK);
+}
+
+// A move can be longer than the array, so the pointer wraps modulo its size, which is only computed on a bound
+
+static void CELL_FN(wrap_memory)(CELL *ptr0, CELL **ptr, size_t size, int shift)
+{
+    long pos = *ptr - ptr0 + shift;
+
+    if ((size_t)pos >= size)
+        pos = (pos % (long)size + (long)size) % (long)size;
+    *ptr = ptr0 + pos;
+}
+
+static void CELL_FN(block_memory)(CELL *ptr0, CELL **ptr, size_t size, int shift)
+{
+    *ptr = (*ptr + shift >= ptr0 + size) ? ptr0 + size - 1 : (*ptr + shift < ptr0) ? ptr0 : *ptr + shift;
+}
+
+/*
+ * seek_zero looks for the first zero cell reached from ptr by steps
+ * of stride cells, without leaving the cell array [begin, end). It
+ * returns this cell if it exists, or the last cell reached before
+ * leaving the array otherwise. The memory behavior then decides
+ * what happens when the pointer goes further (see seekzerocell).
+ *
+ * For the strides allowed by VEC_STRIDE, it compares a whole vector
+ * of cells with zero at once, and keeps the bits of the comparison
+ * mask that match the cells reached by the stride. Each cell has
+ * MASK_BITS bits in the mask. Only aligned vectors are read, so they
+ * can go past the bounds of the array without ever crossing a page
+ * boundary : the cells past the bounds are simply masked out.
+ */
+
+#if defined(VEC_SIZE)
+    #define MASK_BITS       (VEC_BITS * sizeof(CELL))
+    #define STEP_PERIOD(k)  (MASK_BITS * (k) < 64 ? MASK_BITS * (k) : 64)
+    #define STEP_MASK(k)    ((((uint64_t)1 << MASK_BITS) - 1) * (~(uint64_t)0 / (((uint64_t)1 << (STEP_PERIOD(k) - 1) << 1) - 1)))
+
+static CELL *CELL_FN(seek_vector)(CELL *ptr, CELL *begin, CELL *end, int stride)
+{
+   /*
+    * step_mask[k] has the bits of every k-th cell of a vector set,
+    * starting from the first cell. It's shifted by the position of
+    * ptr modulo the stride, which is the same for every vector.
+    */
+
+    static const uint64_t step_mask[5] = {0, STEP_MASK(1), STEP_MASK(2), 0, STEP_MASK(4)};
+    unsigned char *base = (unsigned char *)((uintptr_t)ptr & ~(uintptr_t)(VEC_SIZE - 1));
+    size_t pos = (unsigned char *)ptr - base;
+    int step = stride < 0 ? -stride : stride;
+    uint64_t steps = step_mask[step] << (pos / sizeof(CELL) % step * MASK_BITS);
+    uint64_t mask;
+    CELL *cell;
+
+    if (stride > 0)
+    {
+        mask = CELL_FN(zero_mask)(base) & steps & (~(uint64_t)0 << (pos * VEC_BITS));
+        while (!mask && (CELL *)(base += VEC_SIZE) < end)
+            mask = CELL_FN(zero_mask)(base) & steps;
+        if (mask && (cell = (CELL *)base + __builtin_ctzll(mask) / MASK_BITS) < end)
+            return (cell);
+        return (ptr + (end - 1 - ptr) / stride * stride);
+    }
+    mask = CELL_FN(zero_mask)(base) & steps & (~(uint64_t)0 >> (64 - (pos + sizeof(CELL)) * VEC_BITS));
+    while (!mask && (CELL *)base > begin)
+        mask = CELL_FN(zero_mask)(base -= VEC_SIZE) & steps;
+    if (mask && (cell = (CELL *)base + (63 - __builtin_clzll(mask)) / MASK_BITS) >= begin)
+        return (cell);
+    return (ptr - (ptr - begin) / step * step);
+}
+
+    #undef MASK_BITS
+    #undef STEP_PERIOD
+    #undef STEP_MASK
+#endif
+
+/*
+ * The other strides are scanned 4 steps at a time while they stay in
+ * the array, then one step at a time. n is the number of steps left
+ * before leaving the array.
+ */
+
+static inline CELL *CELL_FN(seek_zero)(CELL *ptr, CELL *begin, CELL *end, int stride)
+{
+    size_t n;
+
+    if (!*ptr || ptr < begin || ptr >= end || !stride)
+        return (ptr);
+#if defined(VEC_SIZE)
+    if (VEC_STRIDE(stride, sizeof(CELL)))
+        return (CELL_FN(seek_vector)(ptr, begin, end, stride));
+#endif
+    n = stride > 0 ? (size_t)(end - 1 - ptr) / stride : (size_t)(ptr - begin) / -stride;
+    for (; n >= 4 && ptr[stride] && ptr[2 * stride] && ptr[3 * stride] && ptr[4 * stride]; n -= 4)
+        ptr += 4 * stride;
+    while (*ptr && n--)
+        ptr += stride;
+    return (ptr);
+}
+
+/*
+ * eval_prologue runs the beginning of the program while the bytecode
+ * is built, since it doesn't depend on anything but the program until
+ * the first input. It stops before the first input, at the end of the
+ * program, after opt->prologue_steps instructions, or before the
+ * first instruction which would reach a cell outside the array : the
+ * memory behaviors only differ there, so they're left to exec_prog.
+ * It stores the state it reaches in pro, with the number of loop
+ * iterations it ran (see exec_prog), and returns the number of
+ * instructions evaluated.
+ */
+
+static size_t CELL_FN(eval_prologue)(const t_instr *prog, t_state *pro, const t_options *opt)
+{
+    size_t size = opt->array_size;
+    CELL *tape = xcalloc(size, sizeof(CELL));
+    size_t capacity = 0;
+    size_t steps;
+    size_t hi = 0;
+    long pos = 0;
+    long ip = 0;
+    long p;
+    long lo;
+    long top;
+    long q;
+    long j;
+    CELL value;
+
+    pro->output = NULL;
+    pro->output_size = 0;
+    pro->pages = NULL;
+    pro->jumps = 0;
+    for (steps = 0; steps < (size_t)opt->prologue_steps; ++steps)
+    {
+        const t_instr *in = prog + ip;
+
+       /*
+        * p is the cell the instruction is at after its move, and
+        * [lo, top] the cells it can reach, which have to be in the
+        * array. A seekzerocell has to find its zero cell in the array,
+        * and counts as one instruction for each step of its scan.
+        */
+
+        p = pos + in->mov;
+        lo = p;
+        top = p;
+        if (in->op == OP_INPUT || in->op == OP_END)
+            break;
+        else if (in->op == OP_MOVE || in->op == OP_ZEROOFFSET || in->op == OP_ZEROBRANCH)
+            q = p + in->coeff;
+        else if (in->op == OP_CHANGEOFFSET || in->op == OP_OFFSETBRANCH || in->op == OP_SET)
+            q = p + OFFSET(in->coeff);
+        else
+            q = p;
+        lo = q < lo ? q : lo;
+        top = q > top ? q : top;
+        for (j = 1; in->op == OP_MUL && j <= in->coeff; ++j)
+        {
+            q = p + in[j].mov;
+            lo = q < lo ? q : lo;
+            top = q > top ? q : top;
+        }
+        if (lo < 0 || (size_t)top >= size)
+            break;
+        if (in->op == OP_SEEK)
+        {
+            q = CELL_FN(seek_zero)(tape + p, tape, tape + size, in->coeff) - tape;
+            if (tape[q])
+                break;
+            steps += (q - p) / in->coeff;
+            top = q > top ? q : top;
+            p = q;
+        }
+        hi = (size_t)top + 1 > hi ? (size_t)top + 1 : hi;
+
+        switch (in->op)
+        {
+            case OP_CHANGE:
+            case OP_CHANGEBRANCH:
+                tape[p] += in->coeff;
+                break;
+            case OP_LEFT:
+                ip += !tape[p] ? in->coeff : 0;
+                break;
+            case OP_RIGHT:
+                if (tape[p])
+                {
+                    ip += in->coeff;
+                    ++pro->jumps;
+                }
+                break;
+            case OP_ZERO:
+                tape[p] = 0;
+                break;
+            case OP_MOVE:
+                tape[p + in->coeff] += tape[p];
+                tape[p] = 0;
+                break;
+            case OP_OUTPUT:
+                if (pro->output_size == capacity)
+                    pro->output = xrealloc(pro->output, capacity = capacity ? capacity * 2 : OUTPUT_SIZE);
+                pro->output[pro->output_size++] = tape[p];
+                break;
+            case OP_MUL:
+                if ((value = tape[p]))
+                {
+                    tape[p] = 0;
+                    for (j = 1; j <= in->coeff; ++j)
+                        tape[p + in[j].mov] += CELL_MUL(value, in[j].coeff);
+                }
+                ip += in->coeff;
+                break;
+            case OP_CHANGEOFFSET:
+            case OP_OFFSETBRANCH:
+                tape[p + OFFSET(in->coeff)] += OFFSET_VALUE(in->coeff);
+                break;
+            case OP_ZEROOFFSET:
+            case OP_ZEROBRANCH:
+                tape[p + in->coeff] = 0;
+                break;
+            case OP_SET:
+                tape[p + OFFSET(in->coeff)] = OFFSET_VALUE(in->coeff);
+                break;
+        }
+
+        // The right bracket of a fused instruction is still in the bytecode, and runs next
+
+        pos = p;
+        ++ip;
+    }
+
+    // Only the cells which were reached are kept, the other ones are still zero
+
+    pro->ip = ip;
+    pro->pos = pos;
+    pro->cells = hi;
+    pro->tape = xrealloc(tape, (hi ? hi : 1) * sizeof(CELL));
+    return (steps);
+}
+
+// The specialized versions of exec_prog
+
+#define BEHAVIOR        NONE
+#define BEHAVIOR_NAME   none
+#include "exec.h"
+
+#define BEHAVIOR        EXTEND
+#define BEHAVIOR_NAME   extend
+#include "exec.h"
+
+#define BEHAVIOR        ABORT
+#define BEHAVIOR_NAME   abort
+#include "exec.h"
+
+#define BEHAVIOR        WRAP
+#define BEHAVIOR_NAME   wrap
+#include "exec.h"
+
+#define BEHAVIOR        BLOCK
+#define BEHAVIOR_NAME   block
+#include "exec.h"
+
+#define BEHAVIOR        GUARDED
+#define BEHAVIOR_NAME   guard
+#include "exec.h"
+
+#undef CELL_FN
+#undef CELL_MUL
@@ -0,0 +1,330 @@
+/** Simple BrainFuck Interpreter V3.2 -- Written by Maxime Rinoldo **/
+
+/*
+ * This file is included by cell.h once for each memory behavior,
+ * with BEHAVIOR defined as the memory behavior and BEHAVIOR_NAME
+ * as its name. It defines the exec_prog specialized for CELL and
+ * BEHAVIOR, named exec_prog_<bits>_<behavior>.
+ *
+ * SHIFT_POINTER moves the pointer with the memory behavior, and
+ * ADD_TO_CELL adds a value to the cell at some offset from the
+ * pointer, moving the pointer there and back if it has to check
+ * the bounds. With guard pages (GUARDED), the pointer moves freely
+ * and the bounds are checked by guard_handler instead, which only
+ * sees the cells that are accessed : with ABORT, a pointer that
+ * leaves the array and comes back without touching a cell outside of
+ * it isn't an error, unlike without guard pages. With EXTEND,
+ * the bounds are the ones of the current page of the tape, which is
+ * array_size cells long.
+ *
+ * exec_prog runs the program from the state start, and returns SBFI_OK
+ * when it ends, SBFI_STEP_LIMIT when it's stopped by opt->step_limit,
+ * or SBFI_ERROR_MEMORY when it reaches a cell outside of the array
+ * with ABORT (with guard pages, exec_prog returns it when guard_handler
+ * jumps back). Whenever it stops, it hands its state over to stop if
+ * it's set, which then owns the cell array : a run stopped by the step
+ * limit is suspended there, and the verifier reads the last cells of
+ * the other ones. Resuming from stop itself takes the cell array back
+ * instead of copying it.
+ */
+
+#if (BEHAVIOR == EXTEND)
+    #define SHIFT_POINTER(shift) { int move = (shift); ptr = (size_t)(ptr - ptr0 + move) < TAPE_PAGE_CELLS ? ptr + move : CELL_FN(extend_memory)(tape, &page, &ptr0, ptr, move); }
+#elif (BEHAVIOR == ABORT)
+    #define SHIFT_POINTER(shift) if (CELL_FN(abort_memory)(ptr0, &ptr, array_size, shift)) goto memory;
+#elif (BEHAVIOR == WRAP)
+    #define SHIFT_POINTER(shift) CELL_FN(wrap_memory)(ptr0, &ptr, array_size, shift);
+#elif (BEHAVIOR == BLOCK)
+    #define SHIFT_POINTER(shift) CELL_FN(block_memory)(ptr0, &ptr, array_size, shift);
+#else
+    #define SHIFT_POINTER(shift) ptr += shift;
+#endif
+
+#if (BEHAVIOR == NONE || BEHAVIOR == GUARDED)
+    #define ADD_TO_CELL(shift, value) *(ptr + (shift)) += (value);
+#else
+    #define ADD_TO_CELL(shift, value) { SHIFT_POINTER(shift) *ptr += (value); SHIFT_POINTER(-(shift)) }
+#endif
+
+static int JOIN(CELL_FN(exec_prog), BEHAVIOR_NAME)(t_instr *prog, const t_state *start, t_state *stop, const t_options *opt)
+{
+#if (BEHAVIOR == EXTEND)
+    size_t array_size = TAPE_PAGE_CELLS;
+#else
+    size_t array_size = opt->array_size > start->cells ? opt->array_size : start->cells;
+#endif
+    uint64_t budget = opt->step_limit ? opt->step_limit : UINT64_MAX;
+    int status = SBFI_OK;
+
+    // ptr0 is where the cell array (or the current page of the tape) begins, ptr is the current pointer
+
+#if (BEHAVIOR == GUARDED)
+    CELL *ptr0 = guard_alloc(array_size, opt->memory, sizeof(CELL));
+#elif (BEHAVIOR == EXTEND)
+    t_tape *tape = start == stop ? start->pages : new_tape(start, sizeof(CELL));
+    long page = (long)start->pos >> TAPE_PAGE_BITS;
+    CELL *ptr0 = tape_page(tape, page);
+#else
+    CELL *ptr0 = start == stop ? start->tape : xcalloc(array_size, sizeof(CELL));
+#endif
+    CELL *ptr = ptr0;
+
+   /*
+    * Thanks to a GCC extension, we can use a special operator "&&" to get
+    * label addresses and store them in an array of pointers. Thus, we will
+    * only need to lookup the next bytecode instruction in this array to
+    * go to the corresponding label without branching or looping at all,
+    * which makes this approach very efficient. You can think of it a bit
+    * like an inline function pointer array.
+    */
+
+    static const void *instr[17] =
+    {
+        &&end,
+        &&changevalue,
+        &&leftbracket,
+        &&rightbracket,
+        &&zerocell,
+        &&seekzerocell,
+        &&movecell,
+        &&output,
+        &&input,
+        &&mulcell,
+        &&changeoffset,
+        &&zerooffset,
+        &&end,
+        &&setoffset,
+        &&changebranch,
+        &&offsetbranch,
+        &&zerobranch
+    };
+
+    // The buffer used for outputs, flushed before the input is read unless only terminals need it
+
+#if (BEHAVIOR == GUARDED)
+    #define buffer_index guard.buffer_index     // Both outlive the run, so that exec_prog prints them after a fault
+    char *buffer = guard.buffer;
+    buffer_index = 0;
+#else
+    char buffer[OUTPUT_SIZE];
+    int buffer_index = 0;
+#endif
+    int flush = !opt->tty_flush || isatty(input.fd);
+
+   /*
+    * i is the index we use to read the Brainfuck program, now converted
+    * into our bytecode. The NEXT_INSTRUCTION macro increments i by one, so
+    * we initialize it with one less than the instruction to execute first,
+    * the one where the start state stopped : the end of the prologue (see
+    * eval_prologue), or where the run was suspended.
+    * NEXT_INSTRUCTION will move directly to the next instruction without
+    * branching, thanks to the "computed gotos" made available by GCC.
+    */
+
+    int i = (int)start->ip - 1;
+    int j;
+    CELL value;
+
+   /*
+    * With direct threading, we first replace each opcode with the
+    * address of its label, so that NEXT_INSTRUCTION can jump to it
+    * without looking it up in instr. The pairs following an M
+    * instruction are never executed, so we skip them. A task resumes
+    * with the bytecode it already threaded (see run_prog), in which
+    * the first label is set.
+    */
+
+#if (DISPATCH == DIRECT_THREADED)
+    if (!prog->label)
+    {
+        for (j = 0; prog[j].op; ++j)
+        {
+            prog[j].label = instr[prog[j].op];
+            if (prog[j].op == OP_MUL)
+                j += prog[j].coeff;
+        }
+        prog[j].label = instr[OP_END];
+    }
+#endif
+
+    // The program resumes from its start state, the output of which comes first
+
+#if (BEHAVIOR == EXTEND)
+    ptr = ptr0 + ((long)start->pos & (TAPE_PAGE_CELLS - 1));
+#else
+    if (ptr0 != start->tape)
+        memcpy(ptr0, start->tape, start->cells * sizeof(CELL));
+    ptr = ptr0 + start->pos;
+#endif
+    write_output(start->output, start->output_size);
+    NEXT_INSTRUCTION
+
+    changevalue:
+        *ptr += prog[i].coeff;
+        NEXT_INSTRUCTION
+
+    leftbracket:
+        i += !(*ptr) ? prog[i].coeff : 0;
+        NEXT_INSTRUCTION
+
+    rightbracket:
+        BACKWARD_JUMP
+        NEXT_INSTRUCTION
+
+    zerocell:
+        *ptr = 0;
+        NEXT_INSTRUCTION
+
+   /*
+    * The cells are scanned with seek_zero until a zero cell is found,
+    * or until the next step leaves the cell array, in which case we
+    * let the memory behavior move the pointer and scan again. With guard
+    * pages, the bounds are the accessible part of the array.
+    *
+    * With WRAP or BLOCK, a scan of an array without any zero cell never
+    * ends, so each step which leaves the array and goes on scanning
+    * counts as a loop iteration, which the source loop would take too.
+    * When the steps run out, the run stops on the scan itself (i is the
+    * instruction before it), which resumes from the pointer it reached.
+    */
+
+    seekzerocell:
+#if (BEHAVIOR == GUARDED)
+        while (*(ptr = CELL_FN(seek_zero)(ptr, (CELL *)guard.begin, (CELL *)guard.end, prog[i].coeff)))
+#else
+        while (*(ptr = CELL_FN(seek_zero)(ptr, ptr0, ptr0 + array_size, prog[i].coeff)))
+#endif
+        {
+            SHIFT_POINTER(prog[i].coeff)
+            if (*ptr && __builtin_expect(!--budget, 0))
+            {
+                --i;
+                goto limit;
+            }
+        }
+        NEXT_INSTRUCTION
+
+   /*
+    * With a memory behavior, the cells touched by movecell and mulcell
+    * go through ADD_TO_CELL, which moves the pointer there and back
+    * just like the loop would. The other cells are only reached if the
+    * loop is entered, hence the check of the current cell : without
+    * it, an empty loop at the end of the array would touch a cell
+    * outside of it, and with guard pages, it would fault.
+    */
+
+    movecell:
+        if ((value = *ptr))
+        {
+            *ptr = 0;
+            ADD_TO_CELL(prog[i].coeff, value)
+        }
+        NEXT_INSTRUCTION
+
+    // The coeff of the pair at i + j is its factor, and its mov is its offset.
+
+    mulcell:
+        if ((value = *ptr))
+        {
+            *ptr = 0;
+            for (j = 1; j <= prog[i].coeff; ++j)
+                ADD_TO_CELL(prog[i + j].mov, CELL_MUL(value, prog[i + j].coeff))
+        }
+        i += prog[i].coeff;
+        NEXT_INSTRUCTION
+
+    // The offset instructions only exist without checking or with guard pages (see optim_code)
+
+    changeoffset:
+        *(ptr + OFFSET(prog[i].coeff)) += OFFSET_VALUE(prog[i].coeff);
+        NEXT_INSTRUCTION
+
+    zerooffset:
+        *(ptr + prog[i].coeff) = 0;
+        NEXT_INSTRUCTION
+
+    // With a memory behavior, setoffset is only made with an offset of 0
+
+    setoffset:
+        *(ptr + OFFSET(prog[i].coeff)) = OFFSET_VALUE(prog[i].coeff);
+        NEXT_INSTRUCTION
+
+    // The instructions fused with the right bracket which follows them
+
+    changebranch:
+        *ptr += prog[i].coeff;
+        RIGHT_BRACKET
+        NEXT_INSTRUCTION
+
+    offsetbranch:
+        *(ptr + OFFSET(prog[i].coeff)) += OFFSET_VALUE(prog[i].coeff);
+        RIGHT_BRACKET
+        NEXT_INSTRUCTION
+
+    zerobranch:
+        *(ptr + prog[i].coeff) = 0;
+        RIGHT_BRACKET
+        NEXT_INSTRUCTION
+
+    // If we encounter an output instruction, we put it in our buffer.
+    // When its size reaches OUTPUT_SIZE, we print it, then reset it.
+
+    output:
+        buffer[buffer_index++] = *ptr;
+        if (buffer_index == OUTPUT_SIZE)
+            PRINT_BUFFER(OUTPUT_SIZE)
+        NEXT_INSTRUCTION
+
+    // In case of input, we first print and reset the output buffer if the input has to be read.
+
+    input:
+        if (input.index == input.size && flush)
+            PRINT_BUFFER(buffer_index)
+        if (input.index < input.size || fill_input())
+            *ptr = input.buffer[input.index++];
+        else if (opt->eof != NO_CHANGE)
+            *ptr = opt->eof;
+        NEXT_INSTRUCTION
+
+    // The program can also stop early, when it runs out of steps or leaves the array with ABORT.
+
+    limit:
+        status = SBFI_STEP_LIMIT;
+        goto end;
+#if (BEHAVIOR == ABORT)
+    memory:
+        status = SBFI_ERROR_MEMORY;
+        goto end;
+#endif
+
+    // When the program stops, we print the output buffer, then hand the cell array over to stop or free it.
+
+    end:
+        PRINT_BUFFER(buffer_index)
+#if (BEHAVIOR == GUARDED)
+        (void)stop;     // The guarded array belongs to the process, it's never handed over
+        guard_free();
+#else
+        if (stop)
+        {
+#if (BEHAVIOR == EXTEND)
+            *stop = (t_state){i + 1, page * TAPE_PAGE_CELLS + (ptr - ptr0), 0, NULL, 0, NULL, tape, 0};
+#else
+            *stop = (t_state){i + 1, ptr - ptr0, array_size, ptr0, 0, NULL, NULL, 0};
+#endif
+            return (status);
+        }
+#if (BEHAVIOR == EXTEND)
+        free_tape(tape);
+#else
+        free(ptr0);
+#endif
+#endif
+        return (status);
+}
+
+#undef SHIFT_POINTER
+#undef ADD_TO_CELL
+#undef buffer_index
+#undef BEHAVIOR
+#undef BEHAVIOR_NAME
@@ -0,0 +1,34 @@
+/** Simple BrainFuck Interpreter V3.2 -- Written by Maxime Rinoldo **/
+
+/*
+ * The libFuzzer entry point of sbfi (see README.md) : the whole
+ * interpreter, without main, verifying each input as a program with
+ * the reference interpreter (see verify_program). The first byte of
+ * the input picks the size of a cell, the EOF behavior and the size
+ * of the array, so that they're explored too, and the other bytes are
+ * the source, which is also given to the program as its input. Any
+ * difference aborts, so that libFuzzer saves the input.
+ */
+
+#define SBFI_LIBRARY 1
+#include "sbfi.c"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const size_t array_sizes[8] = {30000, 1, 2, 7, 16, 64, 1000, 4096};
+    t_options opt = DEFAULT_OPTIONS;
+    t_verify verify = {0, 0, 0, 0};
+    t_src src;
+
+    if (!size)
+        return (0);
+    opt.cell_bits = 8 << (data[0] & 3);
+    opt.eof = data[0] & 4 ? 0 : NO_CHANGE;
+    opt.array_size = array_sizes[data[0] >> 3 & 7];
+    opt.step_limit = FUZZ_STEPS;
+    src = (t_src){(char *)data + 1, size - 1, 0};
+    verify_program(&verify, "input", &src, data + 1, size - 1, &opt);
+    if (verify.failed)
+        abort();
+    return (0);
+}
@@ -0,0 +1,10 @@
+/** Simple BrainFuck Interpreter V3.2 -- Written by Maxime Rinoldo **/
+
+/*
+ * The library build of sbfi (see libsbfi.h) : the whole interpreter,
+ * without main. Only the functions of libsbfi.h are exported from
+ * a shared library built with -fvisibility=hidden (see README.md).
+ */
+
+#define SBFI_LIBRARY 1
+#include "sbfi.c"
@@ -0,0 +1,74 @@
+/** Simple BrainFuck Interpreter V3.2 -- Written by Maxime Rinoldo **/
+
+/*
+ * The library interface of sbfi, built from libsbfi.c (see README.md).
+ *
+ * sbfi_compile builds a program once : it parses and optimizes the
+ * source, with the same options as the command line (e.g. "--cell=16",
+ * "--memory=abort", "--jit"), given as a NULL terminated array. The
+ * handle it returns is never modified afterwards, so it can be run any
+ * number of times, by any number of threads at once.
+ *
+ * sbfi_run runs a program with its own cell array. The input is read
+ * with io->read if it's set, and from the io->input_size bytes at
+ * io->input otherwise, which are then advanced as the input is read.
+ * The output is given to io->write if it's set, and appended to
+ * io->output otherwise, a buffer of io->output_size bytes allocated
+ * with malloc, that the caller frees. step_limit is the number of loop
+ * iterations the program can run before it's stopped, or 0 for no
+ * limit, including the ones run while the program was compiled (see
+ * "--prologue-steps"). The JIT can't count them, so a program compiled
+ * with "--jit" is interpreted when there's a limit.
+ *
+ * A task is a run which can be suspended : sbfi_start creates one at
+ * the beginning of a program, and each call to sbfi_resume runs it for
+ * at most step_limit more loop iterations. It returns SBFI_STEP_LIMIT
+ * when the task is suspended, with its cell array, the position of its
+ * pointer and the input it read in advance kept in the task, so that it
+ * can be resumed later, from any thread. The output is always written
+ * before sbfi_resume returns. Thus a few threads can share the time
+ * between many programs. Once sbfi_resume returned anything else, the
+ * task is done and can only be freed. A task is never run by the JIT.
+ *
+ * Every function returns one of the statuses below instead of exiting,
+ * and sbfi_error describes the last error of the calling thread.
+ */
+
+#ifndef __LIBSBFI_H__
+#define __LIBSBFI_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SBFI_API __attribute__((visibility("default")))
+
+#define SBFI_OK                 0
+#define SBFI_STEP_LIMIT         1
+#define SBFI_ERROR_OPTION       -1
+#define SBFI_ERROR_BRACKETS     -2
+#define SBFI_ERROR_MEMORY       -3
+#define SBFI_ERROR_ALLOC        -4
+
+typedef struct sbfi_program sbfi_program;
+typedef struct sbfi_task sbfi_task;
+
+typedef struct sbfi_io
+{
+    size_t (*read)(void *ctx, char *buffer, size_t size);
+    const char *input;
+    size_t input_size;
+    void (*write)(void *ctx, const char *buffer, size_t size);
+    char *output;
+    size_t output_size;
+    void *ctx;
+}   sbfi_io;
+
+SBFI_API int sbfi_compile(const char *source, size_t size, const char *const *options, sbfi_program **program);
+SBFI_API int sbfi_run(const sbfi_program *program, sbfi_io *io, uint64_t step_limit);
+SBFI_API void sbfi_free(sbfi_program *program);
+SBFI_API int sbfi_start(const sbfi_program *program, sbfi_task **task);
+SBFI_API int sbfi_resume(sbfi_task *task, sbfi_io *io, uint64_t step_limit);
+SBFI_API void sbfi_task_free(sbfi_task *task);
+SBFI_API const char *sbfi_error(void);
+
+#endif
@@ -1,9 +1,12 @@
 /** Simple BrainFuck Interpreter V3.2 -- Written by Maxime Rinoldo **/
 
 /*
- * Use these macros to define the Brainfuck behavior.
+ * Use these macros to define the default Brainfuck behavior.
+ * All of them but DISPATCH can also be changed on the command
+ * line (see main).
  *
- * CELL can be any integer type (default : unsigned char).
+ * CELL_BITS is the size of a cell : 8, 16, 32 or 64 bits
+ * (default : 8).
  *
  * INITIAL_ARRAY_SIZE can be any positive integer (until
  * the machine's limitations are reached) (default : 30000).
@@ -14,27 +17,155 @@
  * EOF_INPUT_BEHAVIOR can be either NO_CHANGE, or the
  * integer that will be written to the cell if EOF is
  * encountered on input (default : NO_CHANGE).
+ *
+ * GUARD_PAGES can be 1 to check the bounds with guard pages
+ * instead of after each move, for EXTEND and ABORT only
+ * (default : 0).
+ *
+ * PROFILE can be 1 to build the profiler, enabled with
+ * --profile, which counts the instructions executed by the
+ * interpreter. It slows it down, so it's compiled out by
+ * default (default : 0).
+ *
+ * TTY_FLUSH can be 1 to flush the output before reading
+ * the input only when it's a terminal, instead of always
+ * (default : 0).
+ *
+ * CACHE_DIR can be the directory where the bytecode of the
+ * programs is cached, or NULL to disable the cache
+ * (default : NULL).
+ *
+ * PROLOGUE_STEPS is the number of instructions at most which
+ * are run while the bytecode is built, until the first input
+ * (see eval_prologue), or 0 to run none (default : 1000000).
+ *
+ * DISPATCH can be COMPUTED_GOTO or DIRECT_THREADED
+ * (default : COMPUTED_GOTO). It doesn't change the
+ * behavior, only the way the bytecode is dispatched.
+ *
+ * SBFI_LIBRARY is set to 1 by libsbfi.c and fuzz.c, which
+ * build sbfi without main (default : 0).
  */
 
-#define CELL                unsigned char
+#define CELL_BITS           8
 #define INITIAL_ARRAY_SIZE  30000
 #define MEMORY_BEHAVIOR     NONE
 #define EOF_INPUT_BEHAVIOR  NO_CHANGE
+#define GUARD_PAGES         0
+#define CACHE_DIR           NULL
+#define TTY_FLUSH           0
+#define PROFILE             0
+#define PROLOGUE_STEPS      1000000
+#define DISPATCH            COMPUTED_GOTO
+
+#ifndef SBFI_LIBRARY
+    #define SBFI_LIBRARY    0
+#endif
 
 #include "sbfi.h"
 
-int *mov;
+/*
+ * The message of the last error is kept in error_message. error
+ * raises an error : it prints the message and exits, unless a
+ * function of the library is running (error_jump is set), in which
+ * case it jumps back there with the status of the error. fail only
+ * stores the message and returns the status, for the errors that
+ * are returned to the caller instead (see exec_prog).
+ */
+
+static __thread char error_message[256];
+static __thread jmp_buf *error_jump;
+
+void die(void)
+{
+    fprintf(stderr, "\nError : %s\n", error_message);
+    exit(EXIT_FAILURE);
+}
 
-void error(const char *msg, ...)
+__attribute__((format(printf, 2, 3))) int fail(int status, const char *msg, ...)
 {
     va_list args;
 
     va_start(args, msg);
-    fprintf(stderr, "\nError : ");
-    vfprintf(stderr, msg, args);
-    fprintf(stderr, "\n");
+    vsnprintf(error_message, sizeof(error_message), msg, args);
     va_end(args);
-    exit(EXIT_FAILURE);
+    return (status);
+}
+
+__attribute__((format(printf, 1, 2))) void error(const char *msg, ...)
+{
+    va_list args;
+
+    va_start(args, msg);
+    vsnprintf(error_message, sizeof(error_message), msg, args);
+    va_end(args);
+    if (error_jump)
+        longjmp(*error_jump, !strcmp(msg, ERROR_ALLOC) ? SBFI_ERROR_ALLOC
+            : !strcmp(msg, ERROR_BRACKETS) ? SBFI_ERROR_BRACKETS : SBFI_ERROR_OPTION);
+    die();
+}
+
+/*
+ * The output and the input are thread local, so that each worker of
+ * the batch mode reads and writes the files of its own job (see
+ * run_job), and each run of the library its own buffers.
+ */
+
+static __thread t_output output = {1, NULL, NULL};
+
+void write_output(const char *buffer, size_t size)
+{
+    ssize_t n;
+
+    if (output.write)
+    {
+        if (size)
+            output.write(output.ctx, buffer, size);
+        return;
+    }
+
+    // write can write less than asked, or be interrupted by a signal
+
+    while (size)
+    {
+        if ((n = write(output.fd, buffer, size)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            error(ERROR_WRITE);
+        }
+        buffer += n;
+        size -= n;
+    }
+}
+
+/*
+ * The input is read in blocks of INPUT_SIZE bytes into input, which
+ * the inputs then consume one byte at a time. fill_input is only
+ * called when the buffer is empty, and returns 0 at the end of the
+ * input. A read error is handled as the end of the input.
+ */
+
+static __thread t_input input;
+
+int fill_input(void)
+{
+    ssize_t n;
+
+    if (input.eof)
+        return (0);
+    if (input.read)
+        n = input.read(input.ctx, (char *)input.buffer, INPUT_SIZE);
+    else
+        while ((n = read(input.fd, input.buffer, INPUT_SIZE)) < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        input.eof = 1;
+        return (0);
+    }
+    input.index = 0;
+    input.size = n;
+    return (1);
 }
 
 void *xcalloc(size_t nmemb, size_t size)
@@ -53,472 +184,3511 @@ void *xrealloc(void *p, size_t size)
     return (p);
 }
 
-char *get_src(const char *filename)
+t_src get_src(const char *filename)
 {
-    FILE *file;
-    char *code;
-    size_t char_nb;
+    t_src src = {NULL, 0, 0};
+    struct stat st;
+    size_t capacity = CHUNK_SIZE;
+    ssize_t n;
+    int fd;
 
     // We try to open the file with the given filename
 
-    if (!(file = fopen(filename, "r")))
+    if ((fd = open(filename, O_RDONLY)) < 0)
         error(ERROR_OPEN_FILE, filename);
+    if (fstat(fd, &st) < 0)
+        error(ERROR_READ_FILE, filename);
 
    /*
-    * We count the number of characters in the file
-    * to allocate the correct amount of memory for
-    * the char * that will contain the code
+    * A regular file is mapped in memory, so that it's read only once,
+    * and only when the front end reaches it. Other files (like pipes)
+    * don't have a known size, so they're read by chunks in a buffer
+    * that doubles its size when it's full.
     */
 
-    for (char_nb = 0; fgetc(file) != EOF; ++char_nb);
-    rewind(file);
-    code = xcalloc(char_nb + 1, sizeof(char));
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        src.size = st.st_size;
+        if ((src.code = mmap(NULL, src.size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+            error(ERROR_READ_FILE, filename);
+        madvise(src.code, src.size, MADV_SEQUENTIAL);
+        src.mapped = 1;
+    }
+    else
+    {
+        src.code = xcalloc(capacity, sizeof(char));
+        while ((n = read(fd, src.code + src.size, capacity - src.size)) > 0)
+            if ((src.size += n) == capacity)
+                src.code = xrealloc(src.code, capacity *= 2);
+        if (n < 0)
+            error(ERROR_READ_FILE, filename);
+    }
+    close(fd);
+    return (src);
+}
 
-    // We copy the content of the file into the char *code
+void free_src(t_src *src)
+{
+    if (src->mapped)
+        munmap(src->code, src->size);
+    else
+        free(src->code);
+}
 
-    if (fread(code, 1, char_nb, file) < char_nb)
-        error(ERROR_READ_FILE, filename);
-    fclose(file);
+/*
+ * With the profiler, profile.pos holds the source position of each
+ * bytecode instruction, taken from the nodes it was made of. The
+ * interpreter counts how many times each instruction runs in
+ * profile.count.
+ */
 
-    return (code);
-}
+#if (PROFILE)
+static t_profile profile;
+#endif
 
-void check_src(const char *code)
+static t_node *push_node(t_ir *ir, int op, int coeff, size_t pos)
 {
-    int i;
-    int n;
+    ir->node[ir->size] = (t_node){op, 0, coeff, pos};
+    return (ir->node + ir->size++);
+}
 
-    // The cell array must be at least one cell long
+/*
+ * The buffer the front end reads the nodes into becomes the image of
+ * the program (see optim_code), so it's allocated once, with room for
+ * the header and for a node or an instruction per character of the
+ * source, whichever is bigger, plus the OP_END one. Only the pages
+ * which are written to take memory.
+ */
 
-#if (INITIAL_ARRAY_SIZE <= 0)
-    error(ERROR_ARRAY_SIZE);
-#endif
+#define IMAGE_CAPACITY(size) (sizeof(t_cache) + ((size) + 1) * (sizeof(t_node) > sizeof(t_instr) ? sizeof(t_node) : sizeof(t_instr)))
+
+t_cache *read_commands(const t_src *src, t_ir *ir, const t_options *opt)
+{
+    int runs = opt->passes & 1 << PASS_RUNS;
+    int turns = opt->memory == BLOCK || (opt->memory == ABORT && !opt->guard);
+    t_cache *image = xcalloc(1, IMAGE_CAPACITY(src->size));
+    size_t left_capacity = CHUNK_SIZE;
+    size_t *left = xcalloc(left_capacity, sizeof(size_t));
+    t_node *last = NULL;
+    size_t i;
+    size_t n = 0;
+    char c;
+    int op;
+    int k;
 
    /*
-    * This counts the number of left and right brackets in the
-    * Brainfuck program code.
+    * This is the whole front end in a single pass over the source :
+    * every character besides Brainfuck commands is a comment, and
+    * each command becomes a node of the IR.
+    *
+    * +/- and >/< become OP_CHANGE and OP_SHIFT nodes respectively,
+    * with a coeff of 1 or -1 depending on their "direction". With
+    * the runs pass, consecutive nodes of the same kind are folded
+    * into a single one with their real count : +++++++ becomes
+    * OP_CHANGE with 7, and <<<<< becomes OP_SHIFT with -5.
     *
-    * We first check if there is more right than left brackets
-    * at any point in the program. If we do, it's a right bracket
-    * mismatch and we raise an error. If we don't, but at the end
-    * of the check the number of left and right brackets are not
-    * the same, it means it's a left bracket mismatch, so we check
-    * the count from the end to the beginning of the code in the
-    * same way, to find the position of the mismatching bracket
-    * (when we have more left than right brackets) and raise an
-    * error.
+    * When the pointer is BLOCKed or ABORTs on a bound, >>< doesn't
+    * always end where > does, so a run of OP_SHIFT also stops
+    * where the pointer turns back.
+    *
+    * Since the pointer movements will end up in the 24 bits mov
+    * field of an instruction, a run of OP_SHIFT is cut in several
+    * nodes if it's too long.
+    *
+    * The nodes end with an OP_END node, and the deepest nesting of
+    * loops is stored in ir->depth. We return the image they're in.
     */
 
-    for (i = 0, n = 0; n >= 0 && code[i]; ++i)
-        n += (code[i] == '[' ? 1 : code[i] == ']' ? -1 : 0);
-    if (n < 0)
-        error(ERROR_BRACKETS, i);
-    else if (n > 0)
+    ir->node = (t_node *)(image + 1);
+    ir->size = 0;
+    ir->depth = 0;
+    for (i = 0; i < src->size; ++i)
     {
-        for (n = 0; n <= 0; --i)
-            n += (code[i] == '[' ? 1 : code[i] == ']' ? -1 : 0);
-        error(ERROR_BRACKETS, i);
-    }
-}
+        c = src->code[i];
+        k = (c == '-' || c == '<') ? -1 : 1;
+        if (c == '+' || c == '-')
+            op = OP_CHANGE;
+        else if (c == '<' || c == '>')
+            op = OP_SHIFT;
+        else if (c == '[' || c == ']' || c == '.' || c == ',')
+        {
+            op = c == '[' ? OP_LEFT : c == ']' ? OP_RIGHT : c == '.' ? OP_OUTPUT : OP_INPUT;
+            k = 0;
+        }
+        else
+            continue;
 
-void strip_comments(char *code)
-{
-    int i;
-    int j;
+       /*
+        * left is a stack of the positions of the left brackets that
+        * aren't matched yet, and n its size. A right bracket with an
+        * empty stack is a mismatch, so we raise an error.
+        */
 
-    // Every character besides Brainfuck commands is a comment
+        if (op == OP_LEFT)
+        {
+            if (n == left_capacity)
+                left = xrealloc(left, (left_capacity *= 2) * sizeof(size_t));
+            left[n++] = i;
+            ir->depth = n > ir->depth ? n : ir->depth;
+        }
+        else if (op == OP_RIGHT && !n--)
+        {
+            free(left);
+            free(image);
+            error(ERROR_BRACKETS, i + 1);
+        }
 
-    for (i = 0, j = 0; code[i]; ++i)
-        if (strchr("+-<>[],.", code[i]))
-            code[j++] = code[i];
-    code[j] = '\0';
-}
+        if (runs && last && last->op == op
+            && (op == OP_CHANGE || (op == OP_SHIFT && last->coeff != MOV_MAX && last->coeff != -MOV_MAX
+            && !(turns && (last->coeff > 0) != (k > 0)))))
+            last->coeff += k;
+        else
+            last = push_node(ir, op, k, i);
+    }
+    push_node(ir, OP_END, 0, src->size);
+    --ir->size;
 
-int match_pattern(const char *codeptr, const char *pattern)
-{
-    size_t i;
-    for (i = 0; pattern[i] && codeptr[i] == pattern[i]; ++i);
-    return (!pattern[i]);
-}
+    // If the stack isn't empty at the end, its top is a left bracket mismatch
 
-int *optim_code(char *code)
-{
-    // These int arrays will allow us to compress commands
+    if (n)
+    {
+        i = left[n - 1];
+        free(left);
+        free(image);
+        error(ERROR_BRACKETS, i + 1);
+    }
+    free(left);
+    return (image);
+}
 
-    int *coeff = xcalloc(strlen(code), sizeof(int));
-    mov = xcalloc(strlen(code), sizeof(int));
+/*
+ * The passes of the optimizer. Each pass reads the nodes with i and
+ * writes them back with j, so a pass can replace several nodes with
+ * fewer ones in place, without leaving any hole. A pass always
+ * keeps the OP_END node last, with its mov, and updates ir->size.
+ *
+ * Until the moves pass, the nodes don't have any mov : the pointer
+ * is only moved by the OP_SHIFT nodes.
+ */
 
+int classify_loop(const t_node *node, size_t left, const t_options *opt, size_t *right)
+{
    /*
-    * Compress consecutive +/-/</> into single commands
-    * associated with the real count in the coeff array
+    * Tells which class the loop beginning at node[left] belongs to,
+    * and sets *right to the index of its right bracket if it isn't
+    * LOOP_OTHER. A loop only made of a single OP_SHIFT, like [>] or
+    * [<<], is a scan, which stops at the first zero cell it finds,
+    * unless the shift is empty, like [<>], which never ends.
     *
-    * For example, +++++++ becomes + with 7
+    * A loop which only contains OP_CHANGE and OP_SHIFT nodes, brings
+    * the pointer back to where it started and decrements the starting
+    * cell by one at each iteration runs exactly as many times as the
+    * value of the starting cell. Each cell it touches is thus
+    * incremented by the starting cell multiplied by some factor, then
+    * the starting cell is set to zero. If it doesn't touch any other
+    * cell, like [-], it's a clear.
     *
-    * We can compress a bit more by exploiting the symmetry
-    * of similar commands, by changing +/- and >/< into a
-    * single command and negating the associated integer in
-    * the coeff array if the "direction" is negative
+    * Since the cells wrap around, this holds for any odd counter c
+    * added to the starting cell at each iteration : the loop runs
+    * -v / c times modulo 2^bits, which is a multiplication of v by the
+    * inverse of -c (see loop_factor). The factors have to fit in the
+    * coeff of a pair, so with 64 bits cells, c can only be 1 or -1,
+    * unless the loop is a clear. The offsets also have to fit in the
+    * mov field of an instruction.
     *
-    * For example, + with 7 becomes c with 7, while - with 5
-    * becomes c with -5
-    *
-    * +/- and >/< are transformed into c and p respectively
+    * When the pointer is BLOCKed on a bound, a loop which moves it
+    * doesn't come back to its starting cell anymore, so we never fold
+    * it, unless it's a scan. When it WRAPs, a loop moving as far as
+    * the size of the array can come back to its starting cell before
+    * its end, and change its counter there, so it isn't folded either.
+    * When it ABORTs, the folded loop only checks the bounds at the cells
+    * it changes, so a loop whose pointer goes beyond them, like
+    * [->>>><<+<<], isn't folded, since it may have to stop there.
     */
 
+    size_t i;
+    int offset = 0;
+    int counter = 0;
+    int target = 0;
+    int moves = 0;
+    int loop = LOOP_CLEAR;
+    int low = 0;        // The offsets reached by the pointer
+    int high = 0;
+    int first = 0;      // The offsets of the cells changed, the starting cell included
+    int last = 0;
+
+    if (node[left].op != OP_LEFT)
+        return (LOOP_OTHER);
+    if (node[left + 1].op == OP_SHIFT && node[left + 1].coeff && node[left + 2].op == OP_RIGHT)
+    {
+        *right = left + 2;
+        return (LOOP_SCAN);
+    }
+    for (i = left + 1; node[i].op == OP_CHANGE || node[i].op == OP_SHIFT; ++i)
+    {
+        if (node[i].op == OP_SHIFT)
+        {
+            offset += node[i].coeff;
+            moves |= node[i].coeff;
+            low = offset < low ? offset : low;
+            high = offset > high ? offset : high;
+            if (offset > MOV_MAX || offset < -MOV_MAX
+                || (opt->memory == WRAP && (size_t)abs(offset) >= opt->array_size))
+                return (LOOP_OTHER);
+        }
+        else if (!offset)
+            counter += node[i].coeff;
+        else
+        {
+            first = offset < first ? offset : first;
+            last = offset > last ? offset : last;
+            if (loop == LOOP_CLEAR || (loop == LOOP_TRANSFER && offset == target))
+            {
+                loop = LOOP_TRANSFER;
+                target = offset;
+            }
+            else
+                loop = LOOP_MULTIPLY;
+        }
+    }
+    if (node[i].op != OP_RIGHT || offset || !(counter % 2) || (moves && opt->memory == BLOCK)
+        || (opt->memory == ABORT && !opt->guard && (low < first || high > last))
+        || (loop != LOOP_CLEAR && opt->cell_bits == 64 && counter != 1 && counter != -1))
+        return (LOOP_OTHER);
+    *right = i;
+    return (loop);
+}
+
+// [-] sets a cell to zero, and so does any loop adding an odd number to it, since the cells wrap around
+
+static void pass_clear(t_ir *ir, const t_options *opt)
+{
+    t_node *node = ir->node;
     size_t i;
     size_t j;
+    size_t right;
 
-    for (i = 0; code[i]; ++i)
+    for (i = 0, j = 0; node[i].op != OP_END; ++i, ++j)
     {
-        if (code[i] == '-' || code[i] == '<')
-            coeff[i] = -1;
-        else
-            coeff[i] = 1;
-        if (code[i] == '+' || code[i] == '-')
-            code[i] = 'c';
-        else if (code[i] == '<' || code[i] == '>')
-            code[i] = 'p';
+        node[j] = node[i];
+        if (classify_loop(node, i, opt, &right) == LOOP_CLEAR)
+        {
+            node[j].op = OP_ZERO;
+            i = right;
+        }
     }
+    node[j] = node[i];
+    ir->size = j;
+}
+
+// [>] / [<] stop at the first zero cell they encounter
+
+static void pass_scan(t_ir *ir, const t_options *opt)
+{
+    t_node *node = ir->node;
+    size_t i;
+    size_t j;
+    size_t right;
 
-    for (i = 0, j = 0; code[i]; ++j)
+    for (i = 0, j = 0; node[i].op != OP_END; ++i, ++j)
     {
-        code[j] = code[i];
-        coeff[j] = coeff[i];
-        if (strchr("cp", code[++i]))
-            for (; code[j] == code[i]; coeff[j] += coeff[i++]);
+        node[j] = node[i];
+        if (classify_loop(node, i, opt, &right) == LOOP_SCAN)
+        {
+            node[j].op = OP_SEEK;
+            node[j].coeff = node[i + 1].coeff;
+            i = right;
+        }
     }
-    code[j] = '\0';
+    node[j] = node[i];
+    ir->size = j;
+}
+
+// The inverse of -counter modulo 2^64, with Newton's iteration, which doubles the number of correct bits each time
+
+static uint64_t loop_factor(int counter)
+{
+    uint64_t inverse = counter;
+    int i;
+
+    for (i = 0; i < 5; ++i)
+        inverse *= 2 - (uint64_t)counter * inverse;
+    return (-inverse);
+}
 
+int fold_mulloop(t_node *node, size_t left, size_t right, size_t j, int bits)
+{
    /*
-    * Optimization of simple Brainfuck constructs that
-    * we can replace with a single command with a coeff.
-    * We overwrite the excess characters with spaces that
-    * we will remove afterwards.
+    * Turns the body of the loop between node[left] and node[right]
+    * into a list of (offset, factor) pairs, one for each cell that
+    * is touched besides the starting one. The pairs are written
+    * from node[j + 1] as OP_PAIR nodes, with the offset in mov and
+    * the factor in coeff. Since j <= left and a node of the body
+    * makes at most one pair, a pair never overwrites a node of the
+    * body which isn't read yet.
     *
-    * TODO: remove useless loops (at least loops immediately
-    * following another loop). When I tried, it made the
-    * program slower for no reason.
+    * The factors are then multiplied by the one of the counter, and
+    * wrapped to the size of a cell, as a signed number.
     *
-    * TODO: optimize more complex constructs. Note : I tried
-    * to optimize "simple loops" since it should be a huge
-    * improvement, but unfortunately it made the program
-    * far slower. I'll continue to search a better solution.
-    *
-    * TODO: make the parser cleaner (without spaces)
+    * We return the number of pairs.
     */
 
-    for (i = 0; code[i]; ++i)
+    size_t i;
+    int offset = 0;
+    int counter = 0;
+    int n = 0;
+    int k;
+    uint64_t factor;
+
+    for (i = left + 1; i < right; ++i)
     {
-        // [-] sets a cell to zero
+        int c = node[i].coeff;
+        size_t pos = node[i].pos;
 
-        if (match_pattern(code + i, "[c]") && coeff[i + 1] == -1)
+        if (node[i].op == OP_SHIFT)
+            offset += c;
+        else if (!offset)
+            counter += c;
+        else
         {
-            code[i] = '0';
-            code[i + 1] = code[i + 2] = ' ';
+            for (k = 0; k < n && node[j + 1 + k].mov != offset; ++k);
+            if (k == n)
+                node[j + 1 + n++] = (t_node){OP_PAIR, offset, 0, pos};
+            node[j + 1 + k].coeff += c;
         }
+    }
 
-        // [>] / [<] stop at the first zero cell they encounter
+    // Cells whose factors cancel out are left untouched by the loop
 
-        else if (match_pattern(code + i, "[p]"))
-        {
-            code[i] = 's';
-            code[i + 1] = code[i + 2] = ' ';
-            coeff[i] = coeff[i + 1];
-        }
+    for (i = 0, k = 0; k < n; ++k)
+    {
+        factor = (uint64_t)node[j + 1 + k].coeff * loop_factor(counter) << (64 - bits);
+        if ((node[j + 1 + k].coeff = (int64_t)factor >> (64 - bits)))
+            node[j + 1 + i++] = node[j + 1 + k];
+    }
+    return (i);
+}
 
-       /*
-        * Loops of the form [-p+p], with the two pointer movements
-        * being opposite, add the current cell to the one accessed
-        * by the pointer movements and set the current cell to zero.
-        *
-        * Here, the coeff will be the size of the pointer movement.
-        *
-        * TODO: add [p+p-] without destroying the performance for long.b :c
-        */
+/*
+ * Multiplication loops like [->+>++>>---<<<<] are executed
+ * in a single pass (see classify_loop). The coeff of the
+ * OP_MUL node is the number of OP_PAIR nodes that follow it.
+ *
+ * The common case of a transfer with a factor of 1, like
+ * [-p+p] or [p+p-], adds the current cell to the one accessed
+ * by the pointer movements and sets the current cell to zero.
+ * It gets its own OP_MOVE node, whose coeff is the offset, since
+ * it doesn't need to loop over the pairs. If no pair is left,
+ * the loop only sets the current cell to zero, which is also how
+ * the clears are folded when the clear pass is disabled.
+ */
+
+static void pass_mul(t_ir *ir, const t_options *opt)
+{
+    t_node *node = ir->node;
+    size_t i;
+    size_t j;
+    size_t right;
+    int loop;
+    int n;
 
-        else if (match_pattern(code + i, "[cpcp]") && coeff[i + 1] == -1 && coeff[i + 3] == 1 && coeff[i + 2] == -coeff[i + 4])
+    for (i = 0, j = 0; node[i].op != OP_END; ++i, ++j)
+    {
+        loop = classify_loop(node, i, opt, &right);
+        if (loop != LOOP_CLEAR && loop != LOOP_TRANSFER && loop != LOOP_MULTIPLY)
         {
-            code[i] = 'm';
-            code[i + 1] = code[i + 2] = code[i + 3] = code[i + 4] = code[i + 5] = ' ';
-            coeff[i] = coeff[i + 2];
+            node[j] = node[i];
+            continue;
         }
-
-        /*
-        else if (match_pattern(code + i, "[pcpc]") && coeff[i + 4] == -1 && coeff[i + 2] == 1 && coeff[i + 1] == -coeff[i + 3])
+        node[j] = node[i];
+        n = fold_mulloop(node, i, right, j, opt->cell_bits);
+        if (n == 0)
+            node[j].op = OP_ZERO;
+        else if (n == 1 && node[j + 1].coeff == 1)
         {
-            code[i] = 'm';
-            code[i + 1] = code[i + 2] = code[i + 3] = code[i + 4] = code[i + 5] = ' ';
-            coeff[i] = coeff[i + 1];
+            node[j].op = OP_MOVE;
+            node[j].coeff = node[j + 1].mov;
         }
-        */
+        else
+        {
+            node[j].op = OP_MUL;
+            node[j].coeff = n;
+            j += n;
+        }
+        i = right;
+    }
+    node[j] = node[i];
+    ir->size = j;
+}
 
-       /*
-        * Moving the pointer is almost always needed to do anything
-        * in a Brainfuck program, so we can couple pointer movements
-        * with the command next to it to treat the latter as one
-        * "movement + command" instruction. The movement is stored
-        * in the "mov" array.
-        *
-        * TODO: For now, mov is a global variable, I should try to
-        * change that
-        */
+// A loop entered on a cell known to be zero is never run, like a loop right after another loop
+
+static void pass_dead(t_ir *ir, const t_options *opt)
+{
+    t_node *node = ir->node;
+    size_t i;
+    size_t j;
+    size_t n;
+    int zero = 1;
+
+   /*
+    * zero tells whether the current cell is known to be zero : at the
+    * beginning of the program, and after a loop or a node which ends
+    * on a zero cell. An output doesn't change the cell.
+    */
 
-        else if (match_pattern(code + i, "p"))
+    (void)opt;
+    for (i = 0, j = 0; node[i].op != OP_END; ++i)
+    {
+        if (node[i].op == OP_LEFT && zero && !node[i].mov)
         {
-            code[i] = ' ';
-            mov[i + 1] += coeff[i];
+            for (n = 1; n; )
+            {
+                ++i;
+                n += (node[i].op == OP_LEFT) - (node[i].op == OP_RIGHT);
+            }
+            continue;
         }
-   }
 
-    // Removing all the spaces
+        // The loops folded by the other passes don't do anything on a zero cell either
 
-    for (i = 0, j = 0; code[i]; ++i)
-    {
-        if (code[i] != ' ')
+        if ((node[i].op == OP_ZERO || node[i].op == OP_SEEK || node[i].op == OP_MOVE || node[i].op == OP_MUL)
+            && zero && !node[i].mov)
         {
-            code[j] = code[i];
-            coeff[j] = coeff[i];
-            mov[j] = mov[i];
-            ++j;
+            i += node[i].op == OP_MUL ? node[i].coeff : 0;
+            continue;
         }
+        if (node[i].op != OP_OUTPUT)
+            zero = node[i].op == OP_RIGHT || node[i].op == OP_ZERO || node[i].op == OP_SEEK
+                || node[i].op == OP_MOVE || node[i].op == OP_MUL;
+        node[j++] = node[i];
+        if (node[i].op == OP_MUL)
+            for (n = node[i].coeff; n; --n)
+                node[j++] = node[++i];
     }
-    code[j] = '\0';
-    coeff[j] = 0;
+    node[j] = node[i];
+    ir->size = j;
+}
 
-   /*
-    * Transform commands into bytecode
-    *  \0  c  [  ]  0  s  m  .  ,
-    *   0  1  2  3  4  5  6  7  8
-    */
+/*
+ * Moving the pointer is almost always needed to do anything
+ * in a Brainfuck program, so we can couple pointer movements
+ * with the node next to them to treat the latter as one
+ * "movement + command" instruction. The movement is stored
+ * in the mov of the node.
+ *
+ * If a run of OP_SHIFT had to be cut, each part but the last one
+ * becomes an OP_CHANGE node which doesn't change the cell value.
+ */
+
+static void pass_moves(t_ir *ir, const t_options *opt)
+{
+    t_node *node = ir->node;
+    size_t i;
+    size_t j;
 
-    for (i = 0; code[i]; ++i)
+    (void)opt;
+    for (i = 0, j = 0; node[i].op != OP_END; ++i)
     {
-        for (j = 0; code[i] != "c[]0sm.,"[j]; ++j);
-        code[i] = j + 1;
+        if (node[i].op == OP_SHIFT && node[i + 1].op != OP_SHIFT)
+        {
+            node[i + 1].mov += node[i].mov + node[i].coeff;
+            continue;
+        }
+        node[j++] = node[i];
     }
-    return (coeff);
+    node[j] = node[i];
+    ir->size = j;
 }
 
-int match_brackets(const char *code, int *coeff, const int left)
-{
-   /*
-    * Recursive function to match the brackets. Each time we
-    * encounter a left bracket, we call the function with the
-    * substring of the code starting from the bracket. Thus,
-    * the first right bracket we encounter has to be the
-    * matching bracket.
-    *
-    * As coeff, we store with each bracket the offset needed to
-    * reach its counterpart.
-    */
+/*
+ * Inside a block of OP_CHANGE and OP_ZERO nodes, the pointer
+ * movements are turned into offsets : >+>+>+<<< becomes
+ * OP_CHANGEOFFSET nodes adding 1 at the offsets 1, 2 and 3, and
+ * the movement of the whole block is done by the next node. Thus,
+ * the pointer isn't updated inside the block anymore. acc is the
+ * offset from the pointer, which stays where the block begins.
+ *
+ * The offsets have to fit in 16 bits (see PACK_OFFSET). If the next
+ * node can't take the whole movement in its mov, the last node of
+ * the block goes back to a normal one, doing the movement itself.
+ *
+ * The memory behaviors check the pointer after each movement, so
+ * this is only done without any checking, or with guard pages.
+ */
 
-    int i;
+static void pass_offsets(t_ir *ir, const t_options *opt)
+{
+    t_node *node = ir->node;
+    size_t i;
+    int acc;
 
-    for (i = left + 1; code[i]; ++i)
+    if (opt->memory != NONE && !opt->guard)
+        return;
+    for (i = 0, acc = 0; ; ++i)
     {
-        if (code[i] == 2)       // left bracket
-            i = match_brackets(code, coeff, i);
-        else if (code[i] == 3)  // right bracket
+        if ((node[i].op == OP_CHANGE || node[i].op == OP_ZERO) && (acc || node[i].mov) && abs(acc + node[i].mov) <= OFFSET_MAX
+            && (node[i].op == OP_ZERO || abs(node[i].coeff) <= OFFSET_MAX))
+        {
+            acc += node[i].mov;
+            node[i].coeff = node[i].op == OP_CHANGE ? PACK_OFFSET(acc, node[i].coeff) : acc;
+            node[i].op = node[i].op == OP_CHANGE ? OP_CHANGEOFFSET : OP_ZEROOFFSET;
+            node[i].mov = 0;
+            continue;
+        }
+        if (abs(acc + node[i].mov) > MOV_MAX)
         {
-            coeff[left] = i - left;
-            coeff[i] = left - i;
-            return (i);
+            node[i - 1].coeff = node[i - 1].op == OP_CHANGEOFFSET ? OFFSET_VALUE(node[i - 1].coeff) : 0;
+            node[i - 1].op = node[i - 1].op == OP_CHANGEOFFSET ? OP_CHANGE : OP_ZERO;
+            node[i - 1].mov = acc;
+            acc = 0;
         }
+        node[i].mov += acc;
+        acc = 0;
+        if (node[i].op == OP_END)
+            break;
+        if (node[i].op == OP_MUL)
+            i += node[i].coeff;
     }
-    return (0);
 }
 
 /*
- * The following functions implement different behaviors
- * regarding the checking of the cell array bounds. They
- * are conditionally compiled if the corresponding macro
- * is defined, in order to not burden the program.
- *
- * If the Brainfuck program tries to access cells outside
- * the cell array, the interpreter can EXTEND the array,
- * WRAP to the other end, BLOCK the pointer movement at
- * the bound, or ABORT the program. Define the
- * MEMORY_BEHAVIOR macro with one of these words to enable
- * the corresponding setting.
+ * Superinstructions, chosen from the pairs of instructions that the
+ * programs of bench/ execute the most. Setting a cell to zero then
+ * adding to it becomes OP_SET, which sets the cell at its offset to
+ * a constant (its coeff is packed like the one of OP_CHANGEOFFSET).
  *
- * If NONE of these settings is enabled, the interpreter
- * will be faster since it won't do any checking. If the
- * program tries to access a cell outside the array, the
- * behavior is undefined (the program may or may not crash
- * or behave unexpectedly).
- *
- * As for the details of the memory behavior functions,
- * it's entirely pointer arithmetic, AKA magic.
+ * An OP_CHANGE, OP_CHANGEOFFSET or OP_ZEROOFFSET node followed by a
+ * right bracket is fused with it : exec_prog then checks the bracket
+ * right after the node, without dispatching it. The bracket stays
+ * in the bytecode, so the other stages (and the jumps to it) still
+ * see a normal bracket.
  */
 
-#if (MEMORY_BEHAVIOR == EXTEND)
-static void extend_memory(CELL **ptr0, CELL **ptr, size_t *size, int shift)
+static void pass_super(t_ir *ir, const t_options *opt)
 {
-    if (*ptr + shift >= *ptr0 + *size)
-    {
-        int old_size;
+    t_node *node = ir->node;
+    size_t i;
+    size_t j;
+    int n;
 
-        old_size = *size;
-        *size = *ptr + shift - *ptr0 + 1;
-        *ptr0 = xrealloc(*ptr0, (*size + 1) * sizeof(CELL));
-        *ptr = *ptr0 + *size - shift - 1;
-        memset(*ptr0 + old_size, 0, *size - old_size);
-    }
-    else if (*ptr + shift < *ptr0)
+    (void)opt;
+    for (i = 0, j = 0; node[i].op != OP_END; ++i, ++j)
     {
-        int old_size;
-        int i;
-
-        old_size = *size;
-        *size += *ptr0 - (*ptr + shift);
-        *ptr0 = xrealloc(*ptr0, (*size + 1) * sizeof(CELL));
-        *ptr = *ptr0 - shift;
-        for (i = old_size; i >= 0; --i)
-            (*ptr0)[i + *size - old_size] = (*ptr0)[i];
-        memset(*ptr0, 0, *size - old_size);
+        node[j] = node[i];
+        if (((node[i].op == OP_ZERO && node[i + 1].op == OP_CHANGE && abs(node[i + 1].coeff) <= OFFSET_MAX)
+            || (node[i].op == OP_ZEROOFFSET && node[i + 1].op == OP_CHANGEOFFSET && OFFSET(node[i + 1].coeff) == node[i].coeff))
+            && !node[i + 1].mov)
+        {
+            node[j].coeff = node[i].op == OP_ZEROOFFSET
+                ? PACK_OFFSET(node[i].coeff, OFFSET_VALUE(node[i + 1].coeff)) : PACK_OFFSET(0, node[i + 1].coeff);
+            node[j].op = OP_SET;
+            ++i;
+        }
+        else if (node[i + 1].op == OP_RIGHT)
+        {
+            if (node[i].op == OP_CHANGE)
+                node[j].op = OP_CHANGEBRANCH;
+            else if (node[i].op == OP_CHANGEOFFSET)
+                node[j].op = OP_OFFSETBRANCH;
+            else if (node[i].op == OP_ZEROOFFSET)
+                node[j].op = OP_ZEROBRANCH;
+        }
+        else if (node[i].op == OP_MUL)
+            for (n = node[i].coeff; n; --n)
+                node[++j] = node[++i];
     }
-    *ptr += shift;
+    node[j] = node[i];
+    ir->size = j;
 }
-#elif (MEMORY_BEHAVIOR == ABORT)
-static void abort_memory(CELL *ptr0, CELL **ptr, size_t size, int shift)
+
+/*
+ * The passes, in the order they run. Each of them can be disabled
+ * with --no-pass=NAME, which clears its bit (1 << its index) in
+ * opt->passes, and --time-passes prints how long each one took.
+ * The runs are folded while the source is read, so that pass has
+ * no function of its own.
+ */
+
+static const t_pass passes[PASS_COUNT] =
 {
-    if (*ptr + shift >= ptr0 + size || *ptr + shift < ptr0)
-        error(ERROR_MEMORY, *ptr - ptr0 + shift, size - 1);
-    *ptr += shift;
-}
-#elif (MEMORY_BEHAVIOR == WRAP)
-static void wrap_memory(CELL *ptr0, CELL **ptr, size_t size, int shift)
+    {"runs", NULL},
+    {"clear", pass_clear},
+    {"scan", pass_scan},
+    {"mul", pass_mul},
+    {"dead", pass_dead},
+    {"moves", pass_moves},
+    {"offsets", pass_offsets},
+    {"super", pass_super}
+};
+
+static double elapsed_ms(const struct timespec *start)
 {
-    *ptr += shift + ((*ptr + shift >= ptr0 + size) ? -size : (*ptr + shift < ptr0) ? size : 0);
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6);
 }
-#elif (MEMORY_BEHAVIOR == BLOCK)
-static void block_memory(CELL *ptr0, CELL **ptr, size_t size, int shift)
+
+// The classes of the innermost loops of the program as it was read, printed with --time-passes
+
+static void print_loops(const t_ir *ir, const t_options *opt)
 {
-    *ptr = (*ptr + shift >= ptr0 + size) ? ptr0 + size - 1 : (*ptr + shift < ptr0) ? ptr0 : *ptr + shift;
+    static const char *names[LOOP_CLASSES] = {"other", "clear", "scan", "transfer", "multiply"};
+    size_t count[LOOP_CLASSES] = {0};
+    size_t right;
+    size_t i;
+    size_t j;
+    int k;
+
+    for (i = 0; i < ir->size; ++i)
+    {
+        for (j = i + 1; ir->node[i].op == OP_LEFT && ir->node[j].op != OP_LEFT && ir->node[j].op != OP_RIGHT; ++j);
+        if (ir->node[i].op == OP_LEFT && ir->node[j].op == OP_RIGHT)
+            ++count[classify_loop(ir->node, i, opt, &right)];
+    }
+    fprintf(stderr, "%-10s", "loops");
+    for (k = 0; k < LOOP_CLASSES; ++k)
+        fprintf(stderr, " %zu %s%s", count[k], names[k], k < LOOP_CLASSES - 1 ? "," : "\n");
 }
-#endif
 
-void exec_prog(const char *code, const int *coeff)
+t_cache *optim_code(const t_src *src, const t_options *opt)
 {
-    size_t array_size = INITIAL_ARRAY_SIZE;
-
-    // ptr0 is where the cell array begins, ptr is the current pointer
+    t_ir ir;
+    struct timespec start;
+    t_cache *image;
+    t_instr *prog;
+    t_node node;
+    size_t *left;
+    size_t i;
+    size_t j;
+    size_t k;
+    size_t n;
+    int forward = sizeof(t_instr) <= sizeof(t_node);
 
-    CELL *ptr0 = xcalloc(array_size, sizeof(CELL));
-    CELL *ptr = ptr0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    image = read_commands(src, &ir, opt);
+    if (opt->time_passes)
+    {
+        fprintf(stderr, "%-10s %12.3f ms %12zu nodes\n", "read", elapsed_ms(&start), ir.size);
+        print_loops(&ir, opt);
+    }
+    for (i = 1; i < PASS_COUNT; ++i)
+    {
+        if (!(opt->passes & 1 << i))
+            continue;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        passes[i].run(&ir, opt);
+        if (opt->time_passes)
+            fprintf(stderr, "%-10s %12.3f ms %12zu nodes\n", passes[i].name, elapsed_ms(&start), ir.size);
+    }
 
    /*
-    * Thanks to a GCC extension, we can use a special operator "&&" to get
-    * label addresses and store them in an array of pointers. Thus, we will
-    * only need to lookup the next bytecode instruction in this array to
-    * go to the corresponding label without branching or looping at all,
-    * which makes this approach very efficient. You can think of it a bit
-    * like an inline function pointer array.
+    * Transform the nodes into bytecode : the opcode of a node is the
+    * one of its instruction (see sbfi.h). An OP_SHIFT node is only
+    * left when the moves pass is disabled, and becomes an instruction
+    * which moves the pointer without changing the cell.
+    *
+    * The OP_PAIR nodes are never executed : they only hold
+    * the pairs read by the OP_MUL instruction preceding them.
+    *
+    * Each node is packed with its coeff and mov into a single
+    * t_instr, so that exec_prog only has to read one array. The
+    * last instruction is the end of the program (0).
+    *
+    * The instructions are written over the nodes, in the same buffer.
+    * When an instruction is smaller than a node, the i-th instruction
+    * always ends before the node i + 1 begins, so we go forward ; with
+    * direct threading, it's bigger, and always begins after the end of
+    * the node i - 1, so we go backward. Either way, a node is read
+    * before its instruction overwrites it. The image is then shrunk
+    * to the size of the bytecode. The labels stay NULL until exec_prog
+    * threads the bytecode.
+    *
+    * The brackets are matched at the same time, with a stack of the
+    * brackets which aren't matched yet : as coeff, we store with each
+    * bracket the offset needed to reach its counterpart.
     */
 
-    static const void *instr[9] =
-    {
-        &&end,
-        &&changevalue,
-        &&leftbracket,
-        &&rightbracket,
-        &&zerocell,
-        &&seekzerocell,
-        &&movecell,
-        &&output,
-        &&input
-    };
+    prog = (t_instr *)(image + 1);
+    left = xcalloc(ir.depth + 1, sizeof(size_t));
+#if (PROFILE)
+    profile.pos = xcalloc(ir.size + 1, sizeof(size_t));
+    profile.count = xcalloc(ir.size + 1, sizeof(uint64_t));
+    profile.size = ir.size;
+#endif
+    for (k = 0, n = 0; k <= ir.size; ++k)
+    {
+        i = forward ? k : ir.size - k;
+        node = ir.node[i];
+        prog[i].op = node.op == OP_SHIFT ? OP_CHANGE : node.op;
+        prog[i].mov = node.op == OP_SHIFT ? node.mov + node.coeff : node.mov;
+        prog[i].coeff = node.op == OP_SHIFT ? 0 : node.coeff;
+#if (DISPATCH == DIRECT_THREADED)
+        prog[i].label = NULL;
+#endif
+#if (PROFILE)
+        profile.pos[i] = node.pos;
+#endif
+        if (node.op == (forward ? OP_LEFT : OP_RIGHT))
+            left[n++] = i;
+        else if (node.op == (forward ? OP_RIGHT : OP_LEFT))
+        {
+            j = left[--n];
+            prog[j].coeff = i - j;
+            prog[i].coeff = j - i;
+        }
+    }
+    free(left);
+    image = xrealloc(image, sizeof(t_cache) + (ir.size + 1) * sizeof(t_instr));
+    *image = (t_cache){CACHE_MAGIC, CACHE_VERSION, 0, src->size, ir.size + 1, 0, 0, 0, 0, 0};
+    return (image);
+}
 
-    // The buffer used for outputs
+/*
+ * The bytecode cache stores the finished program (optimized, with its
+ * brackets matched) in a file named after a hash of the source and of
+ * the settings which change the bytecode, along with the state its
+ * prologue reaches. A later run of the same program maps this file
+ * and skips the whole front end. The cache is only an optimization :
+ * any problem while reading or writing it makes sbfi silently build
+ * the bytecode as usual.
+ */
 
-    char buffer[CHUNK_SIZE];
-    int buffer_index = 0;
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    size_t i;
 
-   /*
-    * i is the index we use to read the Brainfuck program, now converted
-    * into our bytecode. The NEXT_INSTRUCTION macro increments i by one, so
-    * we initialize it with -1 to execute the instruction at position 0.
-    * NEXT_INSTRUCTION will move directly to the next instruction without
-    * branching, thanks to the "computed gotos" made available by GCC.
-    */
+    // 64 bits FNV-1a
 
-    int i = -1;
-    NEXT_INSTRUCTION
+    for (i = 0; i < size; ++i)
+        hash = (hash ^ p[i]) * 0x100000001B3;
+    return (hash);
+}
 
-    changevalue:
-        *ptr += coeff[i];
-        NEXT_INSTRUCTION
+static uint64_t cache_key(const t_src *src, const t_options *opt)
+{
+    // The prologue also depends on the size and the number of cells
 
-    leftbracket:
-        i += !(*ptr) ? coeff[i] : 0;
-        NEXT_INSTRUCTION
+    long long settings[9] = {CACHE_VERSION, sizeof(t_instr), DISPATCH, opt->memory, opt->guard, opt->passes,
+        opt->cell_bits, opt->array_size, opt->prologue_steps};
+    uint64_t key = 0xCBF29CE484222325;
 
-    rightbracket:
-        i += *ptr ? coeff[i] : 0;
-        NEXT_INSTRUCTION
+    key = hash_bytes(key, settings, sizeof(settings));
+    return (hash_bytes(key, src->code, src->size));
+}
 
-    zerocell:
-        *ptr = 0;
-        NEXT_INSTRUCTION
+static void cache_path(uint64_t key, const t_options *opt, char *path, size_t path_size)
+{
+    snprintf(path, path_size, "%s/%016llx.sbc", opt->cache, (unsigned long long)key);
+}
+
+static size_t cache_size(const t_cache *cache, const t_options *opt)
+{
+    return (sizeof(t_cache) + cache->count * sizeof(t_instr) + cache->cells * (opt->cell_bits / 8) + cache->output_size);
+}
+
+// The state of the prologue of an image, whose cells and output follow the instructions
+
+static void image_state(const t_cache *image, t_state *start, const t_options *opt)
+{
+    start->ip = image->ip;
+    start->pos = image->pos;
+    start->cells = image->cells;
+    start->tape = (t_instr *)(image + 1) + image->count;
+    start->output_size = image->output_size;
+    start->output = (char *)start->tape + image->cells * (opt->cell_bits / 8);
+    start->pages = NULL;
+    start->jumps = image->jumps;
+}
+
+// Maps the image of the source of that size and key from the cache
+
+t_cache *load_cache(uint64_t key, size_t size, const t_options *opt)
+{
+    char path[PATH_MAX];
+    t_cache *cache;
+    struct stat st;
+    int fd;
+
+    cache_path(key, opt, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (NULL);
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(t_cache))
+    {
+        close(fd);
+        return (NULL);
+    }
+
+    // The mapping is private and writable, since direct threading writes the labels
+
+    cache = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache == MAP_FAILED)
+        return (NULL);
+    if (memcmp(cache->magic, CACHE_MAGIC, 4) || cache->version != CACHE_VERSION || cache->key != key
+        || cache->size != size || cache_size(cache, opt) != (size_t)st.st_size)
+    {
+        munmap(cache, st.st_size);
+        return (NULL);
+    }
+    return (cache);
+}
+
+void save_cache(const t_cache *image, const t_options *opt)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 16];
+    size_t size = cache_size(image, opt);
+    int fd;
+
+    // The file is written under a temporary name, then renamed, so that no run can map half of it
+
+    cache_path(image->key, opt, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.%lx", path, (long)getpid(), (unsigned long)pthread_self());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    if (write(fd, image, size) != (ssize_t)size)
+    {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    close(fd);
+    if (rename(tmp, path))
+        unlink(tmp);
+}
+
+/*
+ * zero_mask_<bits> compares a vector of cells of that many bits with
+ * zero, and returns a mask with VEC_BITS bits set for each byte of the
+ * zero cells. It is used by seek_zero, see cell.h. Without a compare
+ * of 64 bits lanes, a cell is zero when both of its halves are.
+ *
+ * The aligned vectors can go past the bounds of the array on purpose,
+ * so AddressSanitizer (used with fuzz.c) doesn't check these reads.
+ */
+
+#define ZERO_MASK static inline __attribute__((no_sanitize_address)) uint64_t
+
+#if defined(__AVX2__)
+    #define VEC_SIZE 32
+    #define VEC_BITS 1
+static inline uint64_t vec_mask(__m256i eq)
+{
+    return ((uint32_t)_mm256_movemask_epi8(eq));
+}
+
+ZERO_MASK zero_mask_8(const unsigned char *p)
+{
+    return (vec_mask(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)p), _mm256_setzero_si256())));
+}
+
+ZERO_MASK zero_mask_16(const unsigned char *p)
+{
+    return (vec_mask(_mm256_cmpeq_epi16(_mm256_load_si256((const __m256i *)p), _mm256_setzero_si256())));
+}
+
+ZERO_MASK zero_mask_32(const unsigned char *p)
+{
+    return (vec_mask(_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *)p), _mm256_setzero_si256())));
+}
+
+ZERO_MASK zero_mask_64(const unsigned char *p)
+{
+    return (vec_mask(_mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *)p), _mm256_setzero_si256())));
+}
+#elif defined(__SSE2__)
+    #define VEC_SIZE 16
+    #define VEC_BITS 1
+ZERO_MASK zero_mask_8(const unsigned char *p)
+{
+    return (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), _mm_setzero_si128())));
+}
+
+ZERO_MASK zero_mask_16(const unsigned char *p)
+{
+    return (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128((const __m128i *)p), _mm_setzero_si128())));
+}
+
+ZERO_MASK zero_mask_32(const unsigned char *p)
+{
+    return (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *)p), _mm_setzero_si128())));
+}
+
+ZERO_MASK zero_mask_64(const unsigned char *p)
+{
+    __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)p), _mm_setzero_si128());
+
+    return (_mm_movemask_epi8(_mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)))));
+}
+#elif defined(__ARM_NEON)
+    #define VEC_SIZE 16
+    #define VEC_BITS 4
+static inline uint64_t vec_mask(uint8x16_t eq)
+{
+    return (vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0));
+}
+
+ZERO_MASK zero_mask_8(const unsigned char *p)
+{
+    return (vec_mask(vceqq_u8(vld1q_u8(p), vdupq_n_u8(0))));
+}
+
+ZERO_MASK zero_mask_16(const unsigned char *p)
+{
+    return (vec_mask(vreinterpretq_u8_u16(vceqq_u16(vld1q_u16((const uint16_t *)p), vdupq_n_u16(0)))));
+}
+
+ZERO_MASK zero_mask_32(const unsigned char *p)
+{
+    return (vec_mask(vreinterpretq_u8_u32(vceqq_u32(vld1q_u32((const uint32_t *)p), vdupq_n_u32(0)))));
+}
+
+ZERO_MASK zero_mask_64(const unsigned char *p)
+{
+    uint32x4_t eq = vceqq_u32(vld1q_u32((const uint32_t *)p), vdupq_n_u32(0));
+
+    return (vec_mask(vreinterpretq_u8_u32(vandq_u32(eq, vrev64q_u32(eq)))));
+}
+#endif
+
+/*
+ * The vectorized scan works with strides of 1, 2 or 4 cells, as long
+ * as the stride divides the number of cells in a vector.
+ */
+
+#ifdef VEC_SIZE
+    #define VEC_STRIDE(s, cell) ((s) && abs(s) <= 4 && abs(s) != 3 && abs(s) * (int)(cell) <= VEC_SIZE)
+#endif
+
+/*
+ * The profile report lists the loops, hottest first : the number of
+ * instructions executed inside each loop (including the loops nested
+ * in it), how many times it was entered and how many iterations it
+ * ran. The loops optim_code turned into a single instruction run a
+ * single time per entry, and are flagged with what they became.
+ */
+
+#if (PROFILE)
+static int compare_loops(const void *a, const void *b)
+{
+    const t_loop *x = a;
+    const t_loop *y = b;
+
+    return ((x->cost < y->cost) - (x->cost > y->cost));
+}
+
+void print_profile(const t_instr *prog)
+{
+    static const char *folded[17] = {[OP_ZERO] = "zero", [OP_SEEK] = "scan", [OP_MOVE] = "move", [OP_MUL] = "multiply", [OP_ZEROOFFSET] = "zero", [OP_SET] = "set"};
+    uint64_t *sum = xcalloc(profile.size + 1, sizeof(uint64_t));
+    t_loop *loops = xcalloc(profile.size + 1, sizeof(t_loop));
+    size_t n = 0;
+    size_t i;
+
+    // sum[i] is the number of instructions executed before the position i
+
+    for (i = 0; i < profile.size; ++i)
+        sum[i + 1] = sum[i] + profile.count[i];
+    for (i = 0; i < profile.size; ++i)
+    {
+        if (prog[i].op == OP_LEFT)
+            loops[n++] = (t_loop){profile.pos[i], sum[i + prog[i].coeff + 1] - sum[i], profile.count[i], profile.count[i + prog[i].coeff], NULL};
+        else if (folded[prog[i].op])
+            loops[n++] = (t_loop){profile.pos[i], profile.count[i], profile.count[i], 0, folded[prog[i].op]};
+        if (prog[i].op == OP_MUL)
+            i += prog[i].coeff;
+    }
+    qsort(loops, n, sizeof(t_loop), compare_loops);
+    fprintf(stderr, "\nProfile : %llu instructions executed\n\n", (unsigned long long)sum[profile.size]);
+    fprintf(stderr, "%10s %20s %16s %20s   %s\n", "position", "instructions", "entries", "iterations", "optimization");
+    for (i = 0; i < n && i < PROFILE_LOOPS && loops[i].cost; ++i)
+    {
+        fprintf(stderr, "%10zu %20llu %16llu ", loops[i].pos + 1, (unsigned long long)loops[i].cost, (unsigned long long)loops[i].entries);
+        if (loops[i].folded)
+            fprintf(stderr, "%20s   %s\n", "-", loops[i].folded);
+        else
+            fprintf(stderr, "%20llu   %s\n", (unsigned long long)loops[i].iterations, "none");
+    }
+    free(sum);
+    free(loops);
+    free(profile.pos);
+    free(profile.count);
+}
+#endif
+
+/*
+ * --perf-stats counts the cycles, the instructions, the branch misses
+ * and the read misses of the L1 data cache and of the last level
+ * cache, in user space, around the three phases of a run : loading
+ * the source, compiling it (the passes, the bytecode and the prologue)
+ * and running it. An event the kernel can't count (without hardware
+ * counters, with a strict perf_event_paranoid, or on another system
+ * than Linux) is reported as null. When the kernel had to share the
+ * counters between the events, the counts are scaled to the whole
+ * phase.
+ */
+
+static t_perf perf = {.phase = -1};
+
+void perf_open(void)
+{
+#if defined(__linux__)
+    static const uint64_t events[PERF_EVENTS][2] =
+    {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16}
+    };
+    struct perf_event_attr attr;
+#endif
+    int k;
+
+    for (k = 0; k < PERF_EVENTS; ++k)
+    {
+        perf.fd[k] = -1;
+#if defined(__linux__)
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[k][0];
+        attr.config = events[k][1];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf.fd[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+}
+
+// Ends the phase being measured if there's one, then starts measuring the given phase, or none if it's -1
+
+void perf_phase(int phase, const t_options *opt)
+{
+    int k;
+
+    if (!opt->perf_stats)
+        return;
+    for (k = 0; k < PERF_EVENTS && perf.phase >= 0; ++k)
+    {
+        perf.count[perf.phase][k] = UINT64_MAX;
+#if defined(__linux__)
+        uint64_t value[3];      // The count, then the times the event was enabled and running
+
+        if (perf.fd[k] >= 0 && !ioctl(perf.fd[k], PERF_EVENT_IOC_DISABLE, 0)
+            && read(perf.fd[k], value, sizeof(value)) == sizeof(value) && value[2])
+            perf.count[perf.phase][k] = value[2] < value[1] ? (uint64_t)((double)value[0] * value[1] / value[2]) : value[0];
+#endif
+    }
+    if (perf.phase >= 0)
+        perf.ms[perf.phase] = elapsed_ms(&perf.start);
+    if ((perf.phase = phase) < 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &perf.start);
+#if defined(__linux__)
+    for (k = 0; k < PERF_EVENTS; ++k)
+        if (perf.fd[k] >= 0)
+        {
+            ioctl(perf.fd[k], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf.fd[k], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+}
+
+static void perf_string(const char *s)
+{
+    fputc('"', stderr);
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(stderr, "\\%c", *s);
+        else if ((unsigned char)*s < ' ')
+            fprintf(stderr, "\\u%04x", *s);
+        else
+            fputc(*s, stderr);
+    }
+    fputc('"', stderr);
+}
+
+static void perf_count(const char *name, uint64_t count)
+{
+    if (count == UINT64_MAX)
+        fprintf(stderr, ",\"%s\":null", name);
+    else
+        fprintf(stderr, ",\"%s\":%llu", name, (unsigned long long)count);
+}
+
+/*
+ * The report is a single JSON line on stderr, so that it doesn't mix
+ * with the output of the program. The number of bytecode instructions
+ * dispatched is only counted by the profiler (see PROFILE), so it's
+ * null without it, or when the JIT ran the program.
+ */
+
+void perf_report(const char *filename, const t_options *opt)
+{
+    static const char *phases[PERF_PHASES] = {"load", "compile", "run"};
+    static const char *events[PERF_EVENTS] = {"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+    static const char *memory[5] = {"none", "extend", "abort", "wrap", "block"};
+    uint64_t dispatched = UINT64_MAX;
+    uint64_t *count;
+    int p;
+    int k;
+
+#if (PROFILE)
+    size_t i;
+
+    for (dispatched = 0, i = 0; profile.count && i < profile.size; ++i)
+        dispatched += profile.count[i];
+    if (!dispatched && opt->mode == MODE_JIT)
+        dispatched = UINT64_MAX;
+#endif
+    fprintf(stderr, "{\"file\":");
+    perf_string(filename);
+    fprintf(stderr, ",\"cell\":%d,\"memory\":\"%s\",\"mode\":\"%s\",\"dispatch\":\"%s\",\"phases\":{", opt->cell_bits, memory[opt->memory],
+        opt->mode == MODE_JIT ? "jit" : "interpreter", DISPATCH == DIRECT_THREADED ? "direct_threaded" : "computed_goto");
+    for (p = 0; p < PERF_PHASES; ++p)
+    {
+        count = perf.count[p];
+        fprintf(stderr, "%s\"%s\":{\"ms\":%.3f", p ? "," : "", phases[p], perf.ms[p]);
+        for (k = 0; k < PERF_EVENTS; ++k)
+            perf_count(events[k], count[k]);
+        if (count[0] && count[0] != UINT64_MAX && count[1] != UINT64_MAX)
+            fprintf(stderr, ",\"ipc\":%.3f}", (double)count[1] / count[0]);
+        else
+            fprintf(stderr, ",\"ipc\":null}");
+    }
+    fprintf(stderr, "}");
+    perf_count("dispatched", dispatched);
+    fprintf(stderr, "}\n");
+    for (k = 0; k < PERF_EVENTS; ++k)
+        if (perf.fd[k] >= 0)
+            close(perf.fd[k]);
+}
+
+/*
+ * With guard pages, the cell array is mapped in the middle of a
+ * region of reserved addresses that can't be accessed, so that the
+ * interpreter doesn't have to check the pointer after each move :
+ * reaching a cell outside of the array raises a SIGSEGV instead.
+ * With ABORT, the handler stops the program, which is thus stopped
+ * by an access outside of the array rather than by a move. With
+ * EXTEND, it makes more pages accessible and returns, so the faulting
+ * access is done again, this time successfully. The cells never move, thus the
+ * pointers held by exec_prog stay valid.
+ *
+ * The outer margin of the region, at least one pointer movement
+ * wide, is never made accessible, so that no movement can jump
+ * over the region. Since the memory is mapped by pages, the end of
+ * the array is rounded up to the next page with ABORT.
+ */
+
+static t_guard guard;
+
+static size_t page_round(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return ((size + page - 1) & ~(page - 1));
+}
+
+/*
+ * Nothing that stops the program can be done from the handler, since
+ * error isn't async-signal-safe and the output buffer of the run would
+ * be lost : the handler records the faulting cell and jumps back into
+ * exec_prog, which prints the buffer and raises the error.
+ */
+
+static void guard_fault(int status, uint8_t *addr)
+{
+    guard.fault = (addr - guard.ptr0) / (long)guard.cell;
+    siglongjmp(guard.jump, status);
+}
+
+static void guard_handler(int sig, siginfo_t *info, void *context)
+{
+    uint8_t *addr = info->si_addr;
+    uint8_t *limit;
+    size_t grow;
+
+    (void)context;
+
+   /*
+    * A fault outside of the region isn't ours : we restore the previous
+    * handler and return, so that the access faults again and the program
+    * crashes as it would have without us.
+    */
+
+    if (addr < guard.base || addr >= guard.base + guard.reserved)
+    {
+        sigaction(sig, &guard.old, NULL);
+        return;
+    }
+    if (guard.memory == ABORT)
+        guard_fault(SBFI_ERROR_MEMORY, addr);
+
+    // The accessible part at least doubles each time, to fault less often
+
+    grow = guard.end - guard.begin;
+    if (addr >= guard.end)
+    {
+        limit = guard.base + guard.reserved - guard.margin;
+        if (addr >= limit)
+            guard_fault(SBFI_ERROR_ALLOC, addr);
+        grow = (size_t)(addr - guard.end) < grow ? grow : page_round(addr + 1 - guard.end);
+        grow = grow < (size_t)(limit - guard.end) ? grow : (size_t)(limit - guard.end);
+        if (mprotect(guard.end, grow, PROT_READ | PROT_WRITE))
+            guard_fault(SBFI_ERROR_ALLOC, addr);
+        guard.end += grow;
+    }
+    else
+    {
+        limit = guard.base + guard.margin;
+        if (addr < limit)
+            guard_fault(SBFI_ERROR_ALLOC, addr);
+        grow = (size_t)(guard.begin - addr) <= grow ? grow : page_round(guard.begin - addr);
+        grow = grow < (size_t)(guard.begin - limit) ? grow : (size_t)(guard.begin - limit);
+        if (mprotect(guard.begin - grow, grow, PROT_READ | PROT_WRITE))
+            guard_fault(SBFI_ERROR_ALLOC, addr);
+        guard.begin -= grow;
+    }
+}
+
+void *guard_alloc(size_t array_size, int memory, size_t cell)
+{
+    struct sigaction action;
+    size_t size = page_round(array_size * cell);
+
+    guard.margin = page_round(((size_t)MOV_MAX + 1) * cell);
+    guard.reserved = size + 2 * guard.margin + (memory == EXTEND ? 2 * GUARD_RESERVE : 0);
+    guard.base = mmap(NULL, guard.reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (guard.base == MAP_FAILED)
+        error(ERROR_ALLOC);
+    guard.begin = guard.base + (guard.reserved - size) / 2;
+    guard.end = guard.begin + size;
+    if (mprotect(guard.begin, size, PROT_READ | PROT_WRITE))
+        error(ERROR_ALLOC);
+    guard.ptr0 = guard.begin;
+    guard.size = array_size;
+    guard.cell = cell;
+    guard.memory = memory;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &guard.old);
+    return (guard.ptr0);
+}
+
+void guard_free(void)
+{
+    sigaction(SIGSEGV, &guard.old, NULL);
+    munmap(guard.base, guard.reserved);
+}
+
+/*
+ * With EXTEND, the array is a paged tape, so that the memory used
+ * follows the cells the program actually reaches rather than how far
+ * apart they are. tape_page returns the page number page, which holds
+ * the cells from page * TAPE_PAGE_CELLS, allocating it with its table
+ * if it's reached for the first time. When a table is out of the
+ * directory, the directory grows to reach it, and only the pointers
+ * to the tables are moved. exec_prog only looks a page up when the
+ * pointer leaves the page it's in (see extend_memory).
+ */
+
+void *tape_page(t_tape *tape, long page)
+{
+    long table = page >> TAPE_TABLE_BITS;
+    long first;
+    long last;
+    void **pages;
+
+    if (!tape->count)
+        tape->first = table;
+    first = table < tape->first ? table : tape->first;
+    last = table >= tape->first + (long)tape->count ? table + 1 : tape->first + (long)tape->count;
+    if ((size_t)(last - first) != tape->count)
+    {
+        tape->tables = xrealloc(tape->tables, (last - first) * sizeof(void **));
+        memmove(tape->tables + (tape->first - first), tape->tables, tape->count * sizeof(void **));
+        memset(tape->tables, 0, (tape->first - first) * sizeof(void **));
+        memset(tape->tables + (tape->first - first) + tape->count, 0, (last - tape->first - tape->count) * sizeof(void **));
+        tape->first = first;
+        tape->count = last - first;
+    }
+    if (!(pages = tape->tables[table - tape->first]))
+        pages = tape->tables[table - tape->first] = xcalloc(TAPE_TABLE_SIZE, sizeof(void *));
+    if (!pages[page & (TAPE_TABLE_SIZE - 1)])
+        pages[page & (TAPE_TABLE_SIZE - 1)] = xcalloc(TAPE_PAGE_CELLS, tape->cell);
+    return (pages[page & (TAPE_TABLE_SIZE - 1)]);
+}
+
+// tape_write copies count cells to the tape from the cell pos, one page at a time
+
+void tape_write(t_tape *tape, long pos, const char *cells, size_t count)
+{
+    size_t n;
+
+    for (; count; pos += n, cells += n * tape->cell, count -= n)
+    {
+        n = TAPE_PAGE_CELLS - (pos & (TAPE_PAGE_CELLS - 1));
+        n = n < count ? n : count;
+        memcpy((char *)tape_page(tape, pos >> TAPE_PAGE_BITS) + (pos & (TAPE_PAGE_CELLS - 1)) * tape->cell, cells, n * tape->cell);
+    }
+}
+
+// new_tape makes the paged tape of a run starting from the cells of start
+
+t_tape *new_tape(const t_state *start, size_t cell)
+{
+    t_tape *tape = xcalloc(1, sizeof(t_tape));
+
+    tape->cell = cell;
+    tape_write(tape, 0, start->tape, start->cells);
+    return (tape);
+}
+
+void free_tape(t_tape *tape)
+{
+    size_t i;
+    long j;
+
+    for (i = 0; i < tape->count; ++i)
+    {
+        for (j = 0; tape->tables[i] && j < TAPE_TABLE_SIZE; ++j)
+            free(tape->tables[i][j]);
+        free(tape->tables[i]);
+    }
+    free(tape->tables);
+    free(tape);
+}
+
+/*
+ * The functions depending on the cell type and the interpreter
+ * itself are specialized for each cell size and each memory
+ * behavior (see cell.h and exec.h).
+ */
+
+#define JOIN_(a, b)     a##_##b
+#define JOIN(a, b)      JOIN_(a, b)
+
+#define CELL            uint8_t
+#define CELL_NAME       8
+#include "cell.h"
+#undef CELL
+#undef CELL_NAME
+
+#define CELL            uint16_t
+#define CELL_NAME       16
+#include "cell.h"
+#undef CELL
+#undef CELL_NAME
+
+#define CELL            uint32_t
+#define CELL_NAME       32
+#include "cell.h"
+#undef CELL
+#undef CELL_NAME
+
+#define CELL            uint64_t
+#define CELL_NAME       64
+#include "cell.h"
+#undef CELL
+#undef CELL_NAME
+
+#define EXEC_PROGS(bits) {exec_prog_##bits##_none, exec_prog_##bits##_extend, exec_prog_##bits##_abort, exec_prog_##bits##_wrap, exec_prog_##bits##_block, exec_prog_##bits##_guard}
+
+static int dispatch_prog(t_instr *prog, const t_state *start, t_state *stop, const t_options *opt)
+{
+    // The rows are the cell sizes, the columns the memory behaviors
+
+    static int (*const exec_progs[4][6])(t_instr *, const t_state *, t_state *, const t_options *) =
+    {
+        EXEC_PROGS(8),
+        EXEC_PROGS(16),
+        EXEC_PROGS(32),
+        EXEC_PROGS(64)
+    };
+    int status;
+
+   /*
+    * With guard pages, a fault that stops the program jumps back here
+    * from guard_handler : the output buffer of the run, kept in guard,
+    * is printed and the error is raised outside of the handler. The jump isn't taken
+    * in the run itself, since GCC optimizes a function that calls
+    * sigsetjmp much more cautiously.
+    */
+
+    if (opt->guard && (status = sigsetjmp(guard.jump, 1)))
+    {
+        write_output(guard.buffer, guard.buffer_index);
+        guard_free();
+        if (status == SBFI_ERROR_MEMORY)
+            return (fail(status, ERROR_MEMORY, guard.fault, (long)guard.size - 1));
+        return (fail(status, ERROR_ALLOC));
+    }
+    return (exec_progs[__builtin_ctz(opt->cell_bits / 8)][opt->guard ? GUARDED : opt->memory](prog, start, stop, opt));
+}
+
+/*
+ * The loop iterations the prologue ran are charged to the step limit.
+ * If they reach it, the run would have stopped within the prologue, so
+ * it starts from the beginning of the program instead.
+ */
+
+int exec_prog(t_instr *prog, const t_state *start, t_state *stop, const t_options *opt)
+{
+    t_state origin = {0};
+    t_options run;
+
+    if (!opt->step_limit || !start->jumps)
+        return (dispatch_prog(prog, start, stop, opt));
+    run = *opt;
+    if (start->jumps >= opt->step_limit)
+        start = &origin;
+    else
+        run.step_limit -= start->jumps;
+    return (dispatch_prog(prog, start, stop, &run));
+}
+
+void eval_prologue(const t_instr *prog, t_state *start, const t_options *opt)
+{
+    static size_t (*const eval_prologues[4])(const t_instr *, t_state *, const t_options *) =
+    {
+        eval_prologue_8,
+        eval_prologue_16,
+        eval_prologue_32,
+        eval_prologue_64
+    };
+    struct timespec time;
+    size_t steps;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    steps = eval_prologues[__builtin_ctz(opt->cell_bits / 8)](prog, start, opt);
+    if (opt->time_passes)
+        fprintf(stderr, "%-10s %12.3f ms %12zu steps\n", "prologue", elapsed_ms(&time), steps);
+}
+
+/*
+ * The JIT compiler translates the bytecode into x86-64 machine code,
+ * which runs without any dispatch at all : each instruction becomes
+ * a few native instructions, and the brackets become conditional
+ * jumps to their counterparts.
+ *
+ * The generated function is called with the cell array in rbx and
+ * the output buffer in r12. Only the NONE memory behavior is
+ * supported, since the other ones would need a check after each
+ * pointer movement anyway. On other platforms or settings, jit_prog
+ * returns 0 and the program is run by exec_prog instead.
+ */
+
+#if defined(__x86_64__)
+static void jit_output(t_jit_io *io, int c)
+{
+    io->buffer[io->buffer_index++] = c;
+    if (io->buffer_index == OUTPUT_SIZE)
+    {
+        write_output(io->buffer, OUTPUT_SIZE);
+        io->buffer_index = 0;
+    }
+}
+
+// The cells are written in little endian, which is the byte order of x86-64
+
+static void jit_input(t_jit_io *io, void *ptr)
+{
+    int64_t tmp;
+
+    if (input.index == input.size && io->flush)
+    {
+        write_output(io->buffer, io->buffer_index);
+        io->buffer_index = 0;
+    }
+    if (input.index < input.size || fill_input())
+    {
+        tmp = input.buffer[input.index++];
+        memcpy(ptr, &tmp, io->cell);
+    }
+    else if (io->eof != NO_CHANGE)
+    {
+        tmp = io->eof;
+        memcpy(ptr, &tmp, io->cell);
+    }
+}
+
+// jit_seek scans with the seek_zero of the size of the cells
+
+#define JIT_SEEK(type, bits) \
+    { \
+        type *p = (type *)ptr; \
+        while (*(p = seek_zero_##bits(p, (type *)io->ptr0, (type *)io->end, stride))) \
+            p += stride; \
+        return ((uint8_t *)p); \
+    }
+
+static uint8_t *jit_seek(t_jit_io *io, uint8_t *ptr, int stride)
+{
+    if (io->cell == 1)
+        JIT_SEEK(uint8_t, 8)
+    else if (io->cell == 2)
+        JIT_SEEK(uint16_t, 16)
+    else if (io->cell == 4)
+        JIT_SEEK(uint32_t, 32)
+    JIT_SEEK(uint64_t, 64)
+}
+
+static void emit(t_jit *jit, const void *bytes, size_t n)
+{
+    if (jit->size + n > jit->capacity)
+    {
+        jit->capacity = (jit->size + n) * 2;
+        jit->code = xrealloc(jit->code, jit->capacity);
+    }
+    memcpy(jit->code + jit->size, bytes, n);
+    jit->size += n;
+}
+
+static void emit_byte(t_jit *jit, unsigned char byte)
+{
+    emit(jit, &byte, 1);
+}
+
+static void emit_int(t_jit *jit, int value, size_t n)
+{
+    emit(jit, &value, n);
+}
+
+// Emits an instruction working on the cell at rbx + disp, with the size of a cell
+
+static void emit_cell_op(t_jit *jit, unsigned char op8, unsigned char op, int reg, int disp)
+{
+    if (jit->cell == 2)
+        emit_byte(jit, 0x66);
+    else if (jit->cell == 8)
+        emit_byte(jit, 0x48);
+    emit_byte(jit, jit->cell == 1 ? op8 : op);
+    if (disp)
+    {
+        emit_byte(jit, 0x83 | reg << 3);
+        emit_int(jit, disp * jit->cell, 4);
+    }
+    else
+        emit_byte(jit, 0x03 | reg << 3);
+}
+
+static void emit_cell_imm(t_jit *jit, int value)
+{
+    emit_int(jit, value, jit->cell < 4 ? jit->cell : 4);
+}
+
+// Emits a jump (jmp if cond is 0, jcc otherwise) to target, returns the offset of its rel32
+
+static size_t emit_jump(t_jit *jit, unsigned char cond, size_t target)
+{
+    if (cond)
+    {
+        emit_byte(jit, 0x0F);
+        emit_byte(jit, cond);
+    }
+    else
+        emit_byte(jit, 0xE9);
+    emit_int(jit, target - (jit->size + 4), 4);
+    return (jit->size - 4);
+}
+
+static void patch_jump(t_jit *jit, size_t rel, size_t target)
+{
+    int value = target - (rel + 4);
+
+    memcpy(jit->code + rel, &value, 4);
+}
+
+static void emit_call(t_jit *jit, const void *function)
+{
+    emit(jit, "\x48\xB8", 2);           // mov rax, function
+    emit(jit, &function, 8);
+    emit(jit, "\xFF\xD0", 2);           // call rax
+}
+
+static void emit_load_cell(t_jit *jit)
+{
+    if (jit->cell == 1)
+        emit(jit, "\x0F\xB6\x03", 3);   // movzx eax, byte [rbx]
+    else if (jit->cell == 2)
+        emit(jit, "\x0F\xB7\x03", 3);   // movzx eax, word [rbx]
+    else if (jit->cell == 4)
+        emit(jit, "\x8B\x03", 2);       // mov eax, [rbx]
+    else
+        emit(jit, "\x48\x8B\x03", 3);   // mov rax, [rbx]
+}
+
+static void *jit_compile(const t_instr *prog, size_t cell, size_t start, size_t *size)
+{
+    t_jit jit = {NULL, 0, 0, cell};
+    size_t *left;
+    size_t resume;
+    size_t skip;
+    void *mem;
+    int i;
+    int j;
+
+    // left[i] is where the code after the left bracket at i begins
+
+    for (i = 0; prog[i].op; ++i);
+    left = xcalloc(i + 1, sizeof(size_t));
+
+    emit(&jit, "\x55\x53\x41\x54", 4);      // push rbp; push rbx; push r12
+    emit(&jit, "\x48\x89\xFB", 3);          // mov rbx, rdi
+    emit(&jit, "\x49\x89\xF4", 3);          // mov r12, rsi
+
+    // The code jumps to the instruction where the prologue stopped, patched when it's reached
+
+    resume = emit_jump(&jit, 0, 0);
+    for (i = 0; ; ++i)
+    {
+        if ((size_t)i == start)
+            patch_jump(&jit, resume, jit.size);
+        if (prog[i].mov)
+        {
+            emit(&jit, "\x48\x81\xC3", 3);  // add rbx, mov
+            emit_int(&jit, prog[i].mov * cell, 4);
+        }
+        switch (prog[i].op)
+        {
+            case OP_END:
+                emit(&jit, "\x41\x5C\x5B\x5D\xC3", 5);
+                break;
+            case OP_CHANGE:
+            case OP_CHANGEBRANCH:         // the right bracket follows
+                emit_cell_op(&jit, 0x80, 0x81, 0, 0);
+                emit_cell_imm(&jit, prog[i].coeff);
+                break;
+            case OP_LEFT:                 // the jz is patched by the right bracket
+                emit_cell_op(&jit, 0x80, 0x81, 7, 0);
+                emit_cell_imm(&jit, 0);
+                emit_jump(&jit, 0x84, 0);
+                left[i] = jit.size;
+                break;
+            case OP_RIGHT:
+                emit_cell_op(&jit, 0x80, 0x81, 7, 0);
+                emit_cell_imm(&jit, 0);
+                emit_jump(&jit, 0x85, left[i + prog[i].coeff]);
+                patch_jump(&jit, left[i + prog[i].coeff] - 4, jit.size);
+                break;
+            case OP_ZERO:
+                emit_cell_op(&jit, 0xC6, 0xC7, 0, 0);
+                emit_cell_imm(&jit, 0);
+                break;
+            case OP_SEEK:                 // with the vectorized scan when it applies
+#ifdef VEC_SIZE
+                if (VEC_STRIDE(prog[i].coeff, cell))
+                {
+                    emit(&jit, "\x4C\x89\xE7", 3);          // mov rdi, r12
+                    emit(&jit, "\x48\x89\xDE\xBA", 4);      // mov rsi, rbx; mov edx, stride
+                    emit_int(&jit, prog[i].coeff, 4);
+                    emit_call(&jit, (void *)jit_seek);
+                    emit(&jit, "\x48\x89\xC3", 3);          // mov rbx, rax
+                    break;
+                }
+#endif
+                skip = emit_jump(&jit, 0, 0);
+                emit(&jit, "\x48\x81\xC3", 3);
+                emit_int(&jit, prog[i].coeff * cell, 4);
+                patch_jump(&jit, skip, jit.size);
+                emit_cell_op(&jit, 0x80, 0x81, 7, 0);
+                emit_cell_imm(&jit, 0);
+                emit_jump(&jit, 0x85, skip + 4);
+                break;
+            case OP_MOVE:                 // skipped like mulcell when the cell is zero
+                emit_load_cell(&jit);
+                emit(&jit, "\x48\x85\xC0", 3);          // test rax, rax
+                skip = emit_jump(&jit, 0x84, 0);
+                emit_cell_op(&jit, 0x00, 0x01, 0, prog[i].coeff);
+                emit_cell_op(&jit, 0xC6, 0xC7, 0, 0);
+                emit_cell_imm(&jit, 0);
+                patch_jump(&jit, skip, jit.size);
+                break;
+            case OP_OUTPUT:
+                emit(&jit, "\x4C\x89\xE7", 3);          // mov rdi, r12
+                emit(&jit, "\x0F\xB6\x33", 3);          // movzx esi, byte [rbx]
+                emit_call(&jit, (void *)jit_output);
+                break;
+            case OP_INPUT:
+                emit(&jit, "\x4C\x89\xE7", 3);          // mov rdi, r12
+                emit(&jit, "\x48\x89\xDE", 3);          // mov rsi, rbx
+                emit_call(&jit, (void *)jit_input);
+                break;
+            case OP_MUL:                  // ecx = eax * factor for each pair
+                emit_load_cell(&jit);
+                emit(&jit, "\x48\x85\xC0", 3);          // test rax, rax
+                skip = emit_jump(&jit, 0x84, 0);
+                for (j = 1; j <= prog[i].coeff; ++j)
+                {
+                    emit(&jit, cell == 8 ? "\x48\x69\xC8" : "\x69\xC8", cell == 8 ? 3 : 2);
+                    emit_int(&jit, prog[i + j].coeff, 4);
+                    emit_cell_op(&jit, 0x00, 0x01, 1, prog[i + j].mov);
+                }
+                emit_cell_op(&jit, 0xC6, 0xC7, 0, 0);
+                emit_cell_imm(&jit, 0);
+                patch_jump(&jit, skip, jit.size);
+                i += prog[i].coeff;
+                break;
+            case OP_CHANGEOFFSET:
+            case OP_OFFSETBRANCH:
+                emit_cell_op(&jit, 0x80, 0x81, 0, OFFSET(prog[i].coeff));
+                emit_cell_imm(&jit, OFFSET_VALUE(prog[i].coeff));
+                break;
+            case OP_ZEROOFFSET:
+            case OP_ZEROBRANCH:
+                emit_cell_op(&jit, 0xC6, 0xC7, 0, prog[i].coeff);
+                emit_cell_imm(&jit, 0);
+                break;
+            case OP_SET:
+                emit_cell_op(&jit, 0xC6, 0xC7, 0, OFFSET(prog[i].coeff));
+                emit_cell_imm(&jit, OFFSET_VALUE(prog[i].coeff));
+                break;
+        }
+        if (!prog[i].op)
+            break;
+    }
+    free(left);
+
+    // The code is copied to executable memory, which is never writable at the same time
+
+    mem = mmap(NULL, jit.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED)
+    {
+        memcpy(mem, jit.code, jit.size);
+        if (mprotect(mem, jit.size, PROT_READ | PROT_EXEC))
+        {
+            munmap(mem, jit.size);
+            mem = MAP_FAILED;
+        }
+    }
+    free(jit.code);
+    if (mem == MAP_FAILED)
+        return (NULL);
+    *size = jit.size;
+    return (mem);
+}
+
+int jit_prog(const t_instr *prog, const t_state *start, const t_options *opt)
+{
+    t_jit_io io;
+    uint8_t *base;
+    void *ptr0;
+    void *code;
+    size_t size;
+    size_t cells;
+    size_t mapped;
+
+    io.cell = opt->cell_bits / 8;
+    if (opt->memory != NONE || !(code = jit_compile(prog, io.cell, start->ip, &size)))
+        return (0);
+
+   /*
+    * The cells end right before a page which can't be accessed, so
+    * that an access past the array faults instead of going unnoticed,
+    * and the verifier catches it.
+    */
+
+    cells = opt->array_size * io.cell;
+    mapped = page_round(cells) + page_round(1);
+    if ((base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED
+        || mprotect(base + page_round(cells), page_round(1), PROT_NONE))
+        error(ERROR_ALLOC);
+    ptr0 = base + page_round(cells) - cells;
+    memcpy(ptr0, start->tape, start->cells * io.cell);
+    write_output(start->output, start->output_size);
+    io.buffer_index = 0;
+    io.flush = !opt->tty_flush || isatty(input.fd);
+    io.ptr0 = ptr0;
+    io.end = io.ptr0 + opt->array_size * io.cell;
+    io.eof = opt->eof;
+    ((void (*)(void *, t_jit_io *))code)((uint8_t *)ptr0 + start->pos * io.cell, &io);
+    write_output(io.buffer, io.buffer_index);
+    munmap(base, mapped);
+    munmap(code, size);
+    return (1);
+}
+#else
+int jit_prog(const t_instr *prog, const t_state *start, const t_options *opt)
+{
+    (void)prog;
+    (void)start;
+    (void)opt;
+    return (0);
+}
+#endif
+
+/*
+ * The ahead-of-time compilers print a program equivalent to the
+ * bytecode, either in C or in x86-64 assembly (GNU as syntax), so
+ * that it can be compiled once into a native executable. Each
+ * bytecode instruction becomes a straight-line statement, and the
+ * brackets become loops or jumps.
+ *
+ * The C output follows the cell size, array size, memory behavior
+ * and EOF behavior chosen for the interpreter. The assembly output
+ * only supports the NONE memory behavior.
+ */
+
+static void emit_c_move(const t_options *opt, int shift)
+{
+    if (opt->memory == NONE)
+        printf("p += %d;", shift);
+    else
+        printf("p = move(p, %d);", shift);
+}
+
+void emit_c(const t_instr *prog, const t_options *opt)
+{
+    int depth = 1;
+    int i;
+    int j;
+
+    printf("#include <stdio.h>\n#include <stdlib.h>\n#include <stdint.h>\n#include <string.h>\n#include <unistd.h>\n#include <errno.h>\n\n");
+    printf("#define CELL uint%d_t\n\n", opt->cell_bits);
+    printf("static CELL *p0;\nstatic size_t size = %zu;\n", opt->array_size);
+    printf("static char buffer[%d];\nstatic int buffer_index;\n\n", OUTPUT_SIZE);
+    printf("static void error(const char *msg)\n{\n    fprintf(stderr, \"\\nError : %%s\\n\", msg);\n    exit(EXIT_FAILURE);\n}\n\n");
+    printf("static void print_buffer(void)\n{\n    ssize_t n;\n    int i;\n\n");
+    printf("    for (i = 0; i < buffer_index; i += n)\n    {\n        if ((n = write(1, buffer + i, buffer_index - i)) >= 0)\n            continue;\n");
+    printf("        if (errno != EINTR)\n            error(\"%s\");\n        n = 0;\n    }\n", ERROR_WRITE);
+    printf("    buffer_index = 0;\n}\n\n");
+    printf("static void output(CELL c)\n{\n    buffer[buffer_index++] = c;\n    if (buffer_index == %d)\n        print_buffer();\n}\n\n", OUTPUT_SIZE);
+
+    // Like the interpreter, the input is read by blocks, and the output flushed before reading it
+
+    for (i = 0; prog[i].op && prog[i].op != OP_INPUT; ++i);
+    if (prog[i].op)
+    {
+        printf("static unsigned char input_buffer[%d];\nstatic size_t input_index;\nstatic size_t input_size;\nstatic int input_eof;\n\n", INPUT_SIZE);
+        printf("static int input(void)\n{\n    ssize_t n;\n\n    if (input_index < input_size)\n        return (input_buffer[input_index++]);\n");
+        printf(opt->tty_flush ? "    if (isatty(0))\n        print_buffer();\n" : "    print_buffer();\n");
+        printf("    if (input_eof)\n        return (EOF);\n");
+        printf("    while ((n = read(0, input_buffer, %d)) < 0 && errno == EINTR);\n", INPUT_SIZE);
+        printf("    if (n <= 0)\n    {\n        input_eof = 1;\n        return (EOF);\n    }\n");
+        printf("    input_index = 1;\n    input_size = n;\n    return (input_buffer[0]);\n}\n\n");
+    }
+
+    // The pointer movements mirror the memory behavior functions of the interpreter
+
+    if (opt->memory != NONE)
+        printf("static CELL *move(CELL *p, long shift)\n{\n    long i = p - p0 + shift;\n\n");
+    if (opt->memory == EXTEND)
+    {
+        printf("    size_t n;\n    CELL *q;\n\n    if (i >= 0 && (size_t)i < size)\n        return (p + shift);\n");
+        printf("    n = i < 0 ? (size_t)-i : (size_t)i + 1 - size;\n    n = n > size ? n : size;\n");
+        printf("    if (!(q = calloc(size + n, sizeof(CELL))))\n        error(\"%s\");\n", ERROR_ALLOC);
+        printf("    memcpy(q + (i < 0 ? n : 0), p0, size * sizeof(CELL));\n    free(p0);\n    p0 = q;\n    size += n;\n");
+        printf("    return (i < 0 ? q + n + i : q + i);\n");
+    }
+    else if (opt->memory == ABORT)
+    {
+        printf("    if (i < 0 || (size_t)i >= size)\n    {\n        print_buffer();\n");
+        printf("        fprintf(stderr, \"\\nError : %s\\n\", i, (long)size - 1);\n        exit(EXIT_FAILURE);\n    }\n", ERROR_MEMORY);
+        printf("    return (p + shift);\n");
+    }
+    else if (opt->memory == WRAP)
+        printf("    return (p0 + (i %% (long)size + (long)size) %% (long)size);\n");
+    else if (opt->memory == BLOCK)
+        printf("    return (i >= (long)size ? p0 + size - 1 : i < 0 ? p0 : p + shift);\n");
+    if (opt->memory != NONE)
+        printf("}\n\n");
+
+    printf("int main(void)\n{\n    CELL *p;\n    CELL v;\n");
+    printf(prog[i].op ? "    int c;\n\n" : "\n");
+    printf("    if (!(p = p0 = calloc(size, sizeof(CELL))))\n        error(\"%s\");\n", ERROR_ALLOC);
+    for (i = 0; prog[i].op; ++i)
+    {
+        if (prog[i].op == OP_RIGHT)
+            --depth;
+        printf("%*s", depth * 4, "");
+        if (prog[i].mov)
+        {
+            emit_c_move(opt, prog[i].mov);
+            printf(" ");
+        }
+        switch (prog[i].op)
+        {
+            case OP_CHANGE:
+            case OP_CHANGEBRANCH:
+                printf("*p += %d;", prog[i].coeff);
+                break;
+            case OP_LEFT:
+                printf("while (*p)\n%*s{", depth++ * 4, "");
+                break;
+            case OP_RIGHT:
+                printf("}");
+                break;
+            case OP_ZERO:
+                printf("*p = 0;");
+                break;
+            case OP_SEEK:
+                printf("while (*p) ");
+                emit_c_move(opt, prog[i].coeff);
+                break;
+            case OP_MOVE:
+                if (opt->memory == NONE)
+                    printf("if (*p) { p[%d] += *p; *p = 0; }", prog[i].coeff);
+                else
+                    printf("if ((v = *p)) { *p = 0; p = move(p, %d); *p += v; p = move(p, %d); }", prog[i].coeff, -prog[i].coeff);
+                break;
+            case OP_OUTPUT:
+                printf("output(*p);");
+                break;
+            case OP_INPUT:
+                printf("if ((c = input()) != EOF) *p = c;");
+                if (opt->eof != NO_CHANGE)
+                    printf(" else *p = %d;", opt->eof);
+                break;
+            case OP_MUL:
+                printf("if ((v = *p)) { *p = 0;");
+                for (j = 1; j <= prog[i].coeff; ++j)
+                {
+                    if (opt->memory == NONE)
+                        printf(" p[%d] += (uint64_t)v * %d;", prog[i + j].mov, prog[i + j].coeff);
+                    else
+                        printf(" p = move(p, %d); *p += (uint64_t)v * %d; p = move(p, %d);", prog[i + j].mov, prog[i + j].coeff, -prog[i + j].mov);
+                }
+                printf(" }");
+                i += prog[i].coeff;
+                break;
+            case OP_CHANGEOFFSET:
+            case OP_OFFSETBRANCH:
+                if (opt->memory == NONE)
+                    printf("p[%d] += %d;", OFFSET(prog[i].coeff), OFFSET_VALUE(prog[i].coeff));
+                else
+                    printf("p = move(p, %d); *p += %d; p = move(p, %d);", OFFSET(prog[i].coeff), OFFSET_VALUE(prog[i].coeff), -OFFSET(prog[i].coeff));
+                break;
+            case OP_ZEROOFFSET:
+            case OP_ZEROBRANCH:
+                if (opt->memory == NONE)
+                    printf("p[%d] = 0;", prog[i].coeff);
+                else
+                    printf("p = move(p, %d); *p = 0; p = move(p, %d);", prog[i].coeff, -prog[i].coeff);
+                break;
+            case OP_SET:
+                if (opt->memory == NONE || !OFFSET(prog[i].coeff))
+                    printf("p[%d] = %d;", OFFSET(prog[i].coeff), OFFSET_VALUE(prog[i].coeff));
+                else
+                    printf("p = move(p, %d); *p = %d; p = move(p, %d);", OFFSET(prog[i].coeff), OFFSET_VALUE(prog[i].coeff), -OFFSET(prog[i].coeff));
+                break;
+        }
+        printf("\n");
+    }
+    printf("    print_buffer();\n    free(p0);\n    return (EXIT_SUCCESS);\n}\n");
+}
+
+// Operands of the x86-64 instructions working on a cell
+
+static const char *asm_size(int cell)
+{
+    return (cell == 1 ? "BYTE" : cell == 2 ? "WORD" : cell == 4 ? "DWORD" : "QWORD");
+}
+
+static const char *asm_reg(int cell, int reg)
+{
+    static const char *regs[2][4] = {{"al", "ax", "eax", "rax"}, {"cl", "cx", "ecx", "rcx"}};
+
+    return (regs[reg][cell == 1 ? 0 : cell == 2 ? 1 : cell == 4 ? 2 : 3]);
+}
+
+static int asm_imm(int cell, int value)
+{
+    return (cell == 1 ? (signed char)value : cell == 2 ? (short)value : value);
+}
+
+static void emit_asm_load(int cell)
+{
+    if (cell < 4)
+        printf("    movzx eax, %s PTR [rbx]\n", asm_size(cell));
+    else
+        printf("    mov %s, %s PTR [rbx]\n", asm_reg(cell, 0), asm_size(cell));
+}
+
+void emit_asm(const t_instr *prog, const t_options *opt)
+{
+    int cell = opt->cell_bits / 8;
+    const char *size = asm_size(cell);
+    int i;
+    int j;
+
+    if (opt->memory != NONE)
+        error(ERROR_EMIT_ASM);
+    printf("    .intel_syntax noprefix\n    .text\n    .globl main\nmain:\n    push rbx\n");
+    printf("    mov rdi, %zu\n    mov esi, %d\n    call calloc@PLT\n    mov rbx, rax\n", opt->array_size, cell);
+    for (i = 0; prog[i].op; ++i)
+    {
+        if (prog[i].mov)
+            printf("    add rbx, %d\n", prog[i].mov * cell);
+        switch (prog[i].op)
+        {
+            case OP_CHANGE:
+            case OP_CHANGEBRANCH:
+                printf("    add %s PTR [rbx], %d\n", size, asm_imm(cell, prog[i].coeff));
+                break;
+            case OP_LEFT:
+                printf("    cmp %s PTR [rbx], 0\n    je .Le%d\n.Lb%d:\n", size, i, i);
+                break;
+            case OP_RIGHT:
+                printf("    cmp %s PTR [rbx], 0\n    jne .Lb%d\n.Le%d:\n", size, i + prog[i].coeff, i + prog[i].coeff);
+                break;
+            case OP_ZERO:
+                printf("    mov %s PTR [rbx], 0\n", size);
+                break;
+            case OP_SEEK:
+                printf("    jmp .Lc%d\n.Ls%d:\n    add rbx, %d\n.Lc%d:\n", i, i, prog[i].coeff * cell, i);
+                printf("    cmp %s PTR [rbx], 0\n    jne .Ls%d\n", size, i);
+                break;
+            case OP_MOVE:
+                emit_asm_load(cell);
+                printf("    test rax, rax\n    je .Lm%d\n", i);
+                printf("    add %s PTR [rbx + %d], %s\n", size, prog[i].coeff * cell, asm_reg(cell, 0));
+                printf("    mov %s PTR [rbx], 0\n.Lm%d:\n", size, i);
+                break;
+            case OP_OUTPUT:
+                printf("    movzx edi, BYTE PTR [rbx]\n    call putchar@PLT\n");
+                break;
+            case OP_INPUT:
+                printf("    xor edi, edi\n    call fflush@PLT\n    call getchar@PLT\n    cmp eax, -1\n    je .Li%d\n", i);
+                printf("    mov eax, eax\n    mov %s PTR [rbx], %s\n", size, asm_reg(cell, 0));
+                if (opt->eof != NO_CHANGE)
+                    printf("    jmp .Lj%d\n.Li%d:\n    mov %s PTR [rbx], %d\n.Lj%d:\n", i, i, size, asm_imm(cell, opt->eof), i);
+                else
+                    printf(".Li%d:\n", i);
+                break;
+            case OP_MUL:
+                emit_asm_load(cell);
+                printf("    test rax, rax\n    je .Lm%d\n", i);
+                for (j = 1; j <= prog[i].coeff; ++j)
+                {
+                    printf("    imul %s, %s, %d\n", cell == 8 ? "rcx" : "ecx", cell == 8 ? "rax" : "eax", prog[i + j].coeff);
+                    printf("    add %s PTR [rbx + %d], %s\n", size, prog[i + j].mov * cell, asm_reg(cell, 1));
+                }
+                printf("    mov %s PTR [rbx], 0\n.Lm%d:\n", size, i);
+                i += prog[i].coeff;
+                break;
+            case OP_CHANGEOFFSET:
+            case OP_OFFSETBRANCH:
+                printf("    add %s PTR [rbx + %d], %d\n", size, OFFSET(prog[i].coeff) * cell, asm_imm(cell, OFFSET_VALUE(prog[i].coeff)));
+                break;
+            case OP_ZEROOFFSET:
+            case OP_ZEROBRANCH:
+                printf("    mov %s PTR [rbx + %d], 0\n", size, prog[i].coeff * cell);
+                break;
+            case OP_SET:
+                printf("    mov %s PTR [rbx + %d], %d\n", size, OFFSET(prog[i].coeff) * cell, asm_imm(cell, OFFSET_VALUE(prog[i].coeff)));
+                break;
+        }
+    }
+    printf("    xor eax, eax\n    pop rbx\n    ret\n    .section .note.GNU-stack,\"\",@progbits\n");
+}
+
+/*
+ * A program lives in a single image, laid out like a cache file (see
+ * t_cache) : the header, the instructions, then the cells and the
+ * output of the state its prologue reaches. read_program maps the
+ * image from the cache, or builds the bytecode in it (see optim_code),
+ * after which the source isn't needed anymore. finish_program then
+ * evaluates the prologue, appends its state to the image, and caches
+ * it. build_program does both. The profiler needs the source
+ * positions, which aren't cached, and the passes have to run to be
+ * timed, so the cache isn't used then.
+ */
+
+void read_program(t_program *program, const t_src *src, const t_options *opt)
+{
+    uint64_t key = opt->cache ? cache_key(src, opt) : 0;
+
+    program->image = opt->cache && !opt->profile && !opt->time_passes ? load_cache(key, src->size, opt) : NULL;
+    if (!(program->mapped = program->image != NULL))
+    {
+        program->image = optim_code(src, opt);
+        program->image->key = key;
+    }
+    program->prog = (t_instr *)(program->image + 1);
+}
+
+void finish_program(t_program *program, const t_options *opt)
+{
+    t_cache *image = program->image;
+    t_state pro;
+
+    if (!program->mapped)
+    {
+        eval_prologue(program->prog, &pro, opt);
+        image->ip = pro.ip;
+        image->pos = pro.pos;
+        image->cells = pro.cells;
+        image->output_size = pro.output_size;
+        image->jumps = pro.jumps;
+        program->image = image = xrealloc(image, cache_size(image, opt));
+        program->prog = (t_instr *)(image + 1);
+    }
+    image_state(image, &program->start, opt);
+    if (!program->mapped)
+    {
+        memcpy(program->start.tape, pro.tape, pro.cells * (opt->cell_bits / 8));
+        if (pro.output_size)
+            memcpy(program->start.output, pro.output, pro.output_size);
+        free(pro.tape);
+        free(pro.output);
+        if (opt->cache)
+            save_cache(image, opt);
+    }
+}
+
+void build_program(t_program *program, const t_src *src, const t_options *opt)
+{
+    read_program(program, src, opt);
+    finish_program(program, opt);
+}
+
+void load_program(t_program *program, const t_options *opt)
+{
+    t_src src;
+
+    perf_phase(PERF_LOAD, opt);
+    src = get_src(program->filename);
+    perf_phase(PERF_COMPILE, opt);
+    read_program(program, &src, opt);
+    free_src(&src);
+    finish_program(program, opt);
+}
+
+void free_program(t_program *program, const t_options *opt)
+{
+    if (program->mapped)
+        munmap(program->image, cache_size(program->image, opt));
+    else
+        free(program->image);
+}
+
+/*
+ * With direct threading, exec_prog writes the label addresses in the
+ * bytecode, so each run of a program shared with other threads gets
+ * its own copy of it, which exec_prog only threads once. run_prog
+ * returns the bytecode a run can use, and free_prog frees it.
+ */
+
+static t_instr *run_prog(const t_program *program)
+{
+#if (DISPATCH == DIRECT_THREADED)
+    size_t size;
+
+    for (size = 0; program->prog[size++].op; );
+    return (memcpy(xcalloc(size, sizeof(t_instr)), program->prog, size * sizeof(t_instr)));
+#else
+    return (program->prog);
+#endif
+}
+
+static void free_prog(t_instr *prog)
+{
+#if (DISPATCH == DIRECT_THREADED)
+    free(prog);
+#else
+    (void)prog;
+#endif
+}
+
+/*
+ * run_program runs a program shared with other threads from start,
+ * and returns the status of exec_prog, which suspends it into stop if
+ * it's set. The JIT doesn't count the steps and can't be suspended, so
+ * it isn't used then.
+ */
+
+int run_program(const t_program *program, const t_state *start, t_state *stop, const t_options *opt)
+{
+    t_instr *prog = run_prog(program);
+    int status = SBFI_OK;
+
+    if (!(opt->mode == MODE_JIT && !opt->step_limit && !stop && jit_prog(prog, start, opt)))
+        status = exec_prog(prog, start, stop, opt);
+    free_prog(prog);
+    return (status);
+}
+
+/*
+ * resume_task runs a task for at most steps more loop iterations (0
+ * for no limit), and for at most the ones it has left. The input is
+ * thread local, so what the task read in advance is put back in the
+ * input buffer of the thread, then saved again when it's suspended.
+ * A task which is done keeps its last cells until it's freed.
+ */
+
+int resume_task(t_task *task, uint64_t steps)
+{
+    t_options opt = *task->opt;
+    int status;
+
+    opt.step_limit = task->left && (!steps || task->left < steps) ? task->left : steps;
+    if (task->input)
+        memcpy(input.buffer, task->input, task->input_size);
+    input.index = 0;
+    input.size = task->input_size;
+    input.eof = task->eof;
+    if (!task->prog)
+        task->prog = run_prog(task->program);
+    status = exec_prog(task->prog, task->suspended ? &task->state : &task->program->start, &task->state, &opt);
+    if ((task->suspended = status == SBFI_STEP_LIMIT))
+    {
+        task->left -= task->left ? opt.step_limit : 0;
+        task->input_size = input.size - input.index;
+        task->input = xrealloc(task->input, task->input_size + 1);
+        memcpy(task->input, input.buffer + input.index, task->input_size);
+        task->eof = input.eof;
+    }
+    return (status);
+}
+
+void free_task(t_task *task)
+{
+    if (task->state.pages)
+        free_tape(task->state.pages);
+    else
+        free(task->state.tape);
+    free(task->input);
+    if (task->prog)
+        free_prog(task->prog);
+    task->suspended = 0;
+    task->state = (t_state){0};
+    task->input = NULL;
+    task->prog = NULL;
+}
+
+/*
+ * With --checkpoint=FILE, the program runs as a task, suspended every
+ * CHECKPOINT_SLICE loop iterations to see if a checkpoint is due : after
+ * a SIGUSR1, or every --checkpoint-interval=N seconds. A checkpoint is
+ * the state the task resumes from, with the input it read in advance.
+ * Its output was written when it was suspended, so none is pending.
+ * Only the runs of non zero cells are written, at their index in the
+ * array, or on the tape with EXTEND, where it can be negative. --resume=FILE resumes the program
+ * from a checkpoint, which must have been taken with the same bytecode.
+ * If the input is a file, it's read again from where it was then.
+ */
+
+static volatile sig_atomic_t checkpoint_due;
+
+static void checkpoint_handler(int sig)
+{
+    (void)sig;
+    checkpoint_due = 1;
+}
+
+// The hash of the instructions, without their labels with direct threading
+
+static uint64_t program_key(const t_instr *prog, const t_options *opt)
+{
+    long long settings[3] = {CHECKPOINT_VERSION, opt->cell_bits, opt->memory};
+    uint64_t key = hash_bytes(0xCBF29CE484222325, settings, sizeof(settings));
+    int fields[3];
+
+    do
+    {
+        fields[0] = prog->op;
+        fields[1] = prog->mov;
+        fields[2] = prog->coeff;
+        key = hash_bytes(key, fields, sizeof(fields));
+    } while ((prog++)->op);
+    return (key);
+}
+
+static int zero_cell(const unsigned char *cell, size_t size)
+{
+    while (size--)
+        if (cell[size])
+            return (0);
+    return (1);
+}
+
+// write_runs writes the runs of non zero cells among the count cells at index first
+
+static void write_runs(FILE *file, const unsigned char *cells, size_t count, long first, size_t cell)
+{
+    uint64_t run[2];
+    size_t start;
+    size_t last;
+    size_t i;
+
+    for (i = 0; i < count; )
+    {
+        for (; i < count && zero_cell(cells + i * cell, cell); ++i);
+        if (i == count)
+            break;
+        for (start = i, last = i; i < count && i - last <= CHECKPOINT_GAP; ++i)
+            if (!zero_cell(cells + i * cell, cell))
+                last = i;
+        run[0] = first + (long)start;
+        run[1] = last + 1 - start;
+        fwrite(run, sizeof(run), 1, file);
+        fwrite(cells + start * cell, cell, run[1], file);
+    }
+}
+
+/*
+ * The checkpoint is written under a temporary name, synced, then
+ * renamed, so that the last one is never lost. A checkpoint which
+ * can't be written is reported, and the program goes on.
+ */
+
+void save_checkpoint(const t_task *task, const t_options *opt)
+{
+    off_t offset = lseek(input.fd, 0, SEEK_CUR);
+    t_checkpoint header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, program_key(task->program->prog, opt),
+        task->state.ip, task->state.pos, task->state.cells, task->input_size, offset < 0 ? UINT64_MAX : (uint64_t)offset, task->eof};
+    const t_tape *tape = task->state.pages;
+    size_t cell = opt->cell_bits / 8;
+    uint64_t end[2] = {0, 0};
+    char tmp[PATH_MAX];
+    size_t i;
+    long j;
+    FILE *file;
+    int failed;
+
+    snprintf(tmp, sizeof(tmp), "%s.%ld", opt->checkpoint, (long)getpid());
+    if (!(file = fopen(tmp, "wb")))
+    {
+        fprintf(stderr, "\nError : " ERROR_CHECKPOINT_WRITE "\n", opt->checkpoint);
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(task->input, 1, task->input_size, file);
+    if (!tape)
+        write_runs(file, task->state.tape, task->state.cells, 0, cell);
+    for (i = 0; tape && i < tape->count; ++i)
+        for (j = 0; tape->tables[i] && j < TAPE_TABLE_SIZE; ++j)
+            if (tape->tables[i][j])
+                write_runs(file, tape->tables[i][j], TAPE_PAGE_CELLS, ((tape->first + (long)i) * TAPE_TABLE_SIZE + j) * TAPE_PAGE_CELLS, cell);
+    fwrite(end, sizeof(end), 1, file);
+    failed = fflush(file) || ferror(file) || fsync(fileno(file));
+    if (fclose(file) || failed || rename(tmp, opt->checkpoint))
+    {
+        unlink(tmp);
+        fprintf(stderr, "\nError : " ERROR_CHECKPOINT_WRITE "\n", opt->checkpoint);
+    }
+}
+
+// load_checkpoint suspends a new task where the checkpoint was taken
+
+void load_checkpoint(t_task *task, const char *filename)
+{
+    t_src src = get_src(filename);
+    const t_options *opt = task->opt;
+    size_t cell = opt->cell_bits / 8;
+    t_checkpoint header = {0};
+    uint64_t run[2] = {0, 1};
+    int paged = opt->memory == EXTEND;
+    size_t count;
+    size_t size;
+    char *p;
+
+    for (count = 0; task->program->prog[count++].op; );
+    if (src.size >= sizeof(header))
+        memcpy(&header, src.code, sizeof(header));
+    if (src.size < sizeof(header) || memcmp(header.magic, CHECKPOINT_MAGIC, 4)
+        || header.version != CHECKPOINT_VERSION || header.key != program_key(task->program->prog, opt)
+        || header.ip >= count || (!paged && header.pos >= header.cells) || header.input_size > INPUT_SIZE
+        || header.input_size > src.size - sizeof(header))
+    {
+        free_src(&src);
+        error(ERROR_CHECKPOINT_FILE, filename);
+    }
+    size = header.cells > opt->array_size ? header.cells : opt->array_size;
+    if (paged)
+        task->state = (t_state){header.ip, header.pos, 0, NULL, 0, NULL, new_tape(&(t_state){0}, cell), 0};
+    else
+        task->state = (t_state){header.ip, header.pos, size, xcalloc(size, cell), 0, NULL, NULL, 0};
+    task->suspended = 1;
+    task->input_size = header.input_size;
+    task->input = memcpy(xcalloc(header.input_size + 1, 1), src.code + sizeof(header), header.input_size);
+    task->eof = header.eof;
+    if (header.input_offset != UINT64_MAX)
+        lseek(input.fd, header.input_offset, SEEK_SET);
+
+    // Each run has to fit in the array, or on the tape, and in what's left of the file
+
+    p = src.code + sizeof(header) + header.input_size;
+    while ((size_t)(src.code + src.size - p) >= sizeof(run))
+    {
+        memcpy(run, p, sizeof(run));
+        p += sizeof(run);
+        if (!run[1] || run[1] > (size_t)(src.code + src.size - p) / cell
+            || (paged ? (int64_t)run[0] > INT64_MAX - (int64_t)run[1] : run[0] >= header.cells || run[1] > header.cells - run[0]))
+            break;
+        if (paged)
+            tape_write(task->state.pages, (long)run[0], p, run[1]);
+        else
+            memcpy((char *)task->state.tape + run[0] * cell, p, run[1] * cell);
+        p += run[1] * cell;
+    }
+    free_src(&src);
+    if (run[1])
+    {
+        free_task(task);
+        error(ERROR_CHECKPOINT_FILE, filename);
+    }
+}
+
+/*
+ * run_checkpoints runs the program as a task, taking the checkpoints
+ * if there's a checkpoint file, and returns the status of exec_prog.
+ * The handlers restart the reads they interrupt.
+ */
+
+int run_checkpoints(const t_program *program, const t_options *opt)
+{
+    t_task task = {program, opt, 0, {0}, NULL, 0, 0, opt->step_limit, NULL};
+    struct itimerval timer = {{opt->checkpoint_interval, 0}, {opt->checkpoint_interval, 0}};
+    struct sigaction action;
+    int status;
+
+    if (opt->resume)
+        load_checkpoint(&task, opt->resume);
+    if (opt->checkpoint)
+    {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = checkpoint_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, NULL);
+        if (opt->checkpoint_interval)
+        {
+            sigaction(SIGALRM, &action, NULL);
+            setitimer(ITIMER_REAL, &timer, NULL);
+        }
+    }
+    while ((status = resume_task(&task, opt->checkpoint ? CHECKPOINT_SLICE : 0)) == SBFI_STEP_LIMIT
+        && (!opt->step_limit || task.left))
+    {
+        if (checkpoint_due)
+        {
+            checkpoint_due = 0;
+            save_checkpoint(&task, opt);
+        }
+    }
+    free_task(&task);
+    return (status);
+}
 
-    seekzerocell:
-        for (; *ptr; ptr += coeff[i]);
-        NEXT_INSTRUCTION
+/*
+ * The batch mode runs many jobs in a single process, on a pool of
+ * worker threads, instead of paying the startup of sbfi for each one.
+ * The jobs are the files given on the command line, with an empty
+ * input, and the lines of the manifest, each one a program and an
+ * optional input file. The output of the n-th job (from 1) is written
+ * to DIR/n.out.
+ *
+ * Each program is built once, before the workers start, and its
+ * bytecode and prologue are then only read by the jobs running it.
+ * Each job gets its own cell array and output buffer from exec_prog,
+ * and its own input buffer, since input is thread local. A job which
+ * fails prints its error, and the other jobs go on, but sbfi then
+ * exits with an error.
+ *
+ * With --slice=N, each job runs as a task for N loop iterations at a
+ * time, then goes back to the end of the queue, so that a few long
+ * jobs can't hold every thread while the short ones wait. With
+ * --step-limit=N, a job is stopped after N loop iterations in total.
+ */
 
-    movecell:
-        *(ptr + coeff[i]) += *ptr;
-        *ptr = 0;
-        NEXT_INSTRUCTION
+void add_job(t_batch *batch, const char *filename, const char *input)
+{
+    size_t i;
 
-    // If we encounter an output instruction, we put it in our buffer.
-    // When its size reaches CHUNK_SIZE, we print it, then reset it.
+    for (i = 0; i < batch->program_count && strcmp(batch->programs[i].filename, filename); ++i);
+    if (i == batch->program_count)
+    {
+        if (batch->program_count == batch->program_capacity)
+            batch->programs = xrealloc(batch->programs, (batch->program_capacity = batch->program_capacity * 2 + 1) * sizeof(t_program));
+        batch->programs[batch->program_count++] = (t_program){filename, NULL, {0}, NULL, 0};
+    }
+    if (batch->size == batch->capacity)
+        batch->jobs = xrealloc(batch->jobs, (batch->capacity = batch->capacity * 2 + 1) * sizeof(t_job));
+    batch->jobs[batch->size++] = (t_job){i, input, -1, -1, {NULL, NULL, 0, {0}, NULL, 0, 0, 0, NULL}};
+}
 
-    output:
-        buffer[buffer_index++] = *ptr;
-        if (buffer_index == CHUNK_SIZE)
-            PRINT_BUFFER(CHUNK_SIZE)
-        NEXT_INSTRUCTION
+// The blank lines and the lines beginning with # are ignored
 
-    // In case of input, we first print and reset the output buffer.
+void read_manifest(t_batch *batch, const char *filename)
+{
+    t_src src = get_src(filename);
+    char *line;
+    char *next;
+    char *save;
+    char *program;
+    char *input;
+    int n;
 
-    input:
-        PRINT_BUFFER(buffer_index)
-        int tmp;
-        if ((tmp = getchar()) != EOF)
-            *ptr = tmp;
-#if (EOF_INPUT_BEHAVIOR != NO_CHANGE)
-        else
-            *ptr = EOF_INPUT_BEHAVIOR;
-#endif
-        NEXT_INSTRUCTION
+    batch->manifest = xcalloc(src.size + 1, sizeof(char));
+    memcpy(batch->manifest, src.code, src.size);
+    free_src(&src);
+    for (line = batch->manifest, n = 1; *line; line = next, ++n)
+    {
+        next = line + strcspn(line, "\n");
+        if (*next)
+            *next++ = '\0';
+        if (!(program = strtok_r(line, " \t\r", &save)) || *program == '#')
+            continue;
+        input = strtok_r(NULL, " \t\r", &save);
+        if (strtok_r(NULL, " \t\r", &save))
+            error(ERROR_MANIFEST_LINE, n, filename);
+        add_job(batch, program, input);
+    }
+}
 
-    // When the program ends, we print the output buffer and free the cell array.
+/*
+ * run_job returns the status of the job, which is still suspended at
+ * the end of its slice, and is done otherwise : a job stopped by its
+ * step limit also returns SBFI_STEP_LIMIT. Like in the library,
+ * error_jump brings the errors raised while the job runs (an allocation
+ * or a write which fails) back here, so that only this job fails.
+ */
+
+static int run_job(const t_batch *batch, size_t n)
+{
+    t_job *job = batch->jobs + n;
+    char path[PATH_MAX];
+    jmp_buf jump;
+    int status = SBFI_OK;
 
-    end:
-        PRINT_BUFFER(buffer_index)
-        free(ptr0);
+    if (job->output_fd < 0)
+    {
+        snprintf(path, sizeof(path), "%s/%zu.out", batch->opt->batch, n + 1);
+        if ((job->output_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+            status = fail(SBFI_ERROR_OPTION, ERROR_OPEN_FILE, path);
+        else if (job->input && (job->input_fd = open(job->input, O_RDONLY)) < 0)
+            status = fail(SBFI_ERROR_OPTION, ERROR_OPEN_FILE, job->input);
+    }
+    if (!status && !(status = setjmp(jump)))
+    {
+        error_jump = &jump;
+        output.fd = job->output_fd;
+        input.fd = job->input_fd;
+        status = resume_task(&job->task, batch->opt->slice);
+    }
+    error_jump = NULL;
+    if (status == SBFI_STEP_LIMIT && (!batch->opt->step_limit || job->task.left))
+        return (status);
+    if (status == SBFI_STEP_LIMIT)
+        status = fail(status, ERROR_STEP_LIMIT, (unsigned long long)batch->opt->step_limit);
+    if (status)
+        fprintf(stderr, "\nError : job %zu : %s\n", n + 1, error_message);
+    free_task(&job->task);
+    if (job->output_fd >= 0)
+        close(job->output_fd);
+    if (job->input_fd >= 0)
+        close(job->input_fd);
+    return (status);
 }
 
-int main(int ac, char **av)
+/*
+ * The workers take the jobs from the queue until every job is done.
+ * A worker which finds the queue empty waits for a job to be suspended,
+ * or for the last job to be done.
+ */
+
+static void *batch_worker(void *arg)
 {
-    char *code;
-    int *coeff;
+    t_batch *batch = arg;
+    size_t n;
+    int status;
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->remaining)
+    {
+        if (!batch->queued)
+        {
+            pthread_cond_wait(&batch->ready, &batch->lock);
+            continue;
+        }
+        n = batch->queue[batch->head];
+        batch->head = (batch->head + 1) % batch->size;
+        --batch->queued;
+        pthread_mutex_unlock(&batch->lock);
+        status = run_job(batch, n);
+        pthread_mutex_lock(&batch->lock);
+        if (batch->jobs[n].task.suspended)
+            batch->queue[(batch->head + batch->queued++) % batch->size] = n;
+        else
+        {
+            --batch->remaining;
+            batch->failed += status != SBFI_OK;
+        }
+        pthread_cond_broadcast(&batch->ready);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return (NULL);
+}
+
+// run_batch returns the exit status of sbfi, which is an error if any job failed
 
-    // Usage: ./sbfi filename
+int run_batch(t_batch *batch, const t_options *opt)
+{
+    pthread_t *threads;
+    long count = opt->jobs ? opt->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    long n;
+    size_t i;
 
-    if (ac < 2)
+    if (opt->guard || opt->profile || opt->mode == MODE_EMIT_C || opt->mode == MODE_EMIT_ASM)
+        error(ERROR_BATCH);
+    if (!batch->size)
         error(ERROR_NO_ARGS);
-    else if (ac > 2)
-        error(ERROR_TOO_MANY_ARGS);
-
-    code = get_src(av[1]);
-    check_src(code);
-    strip_comments(code);
-    coeff = optim_code(code);
-    match_brackets(code, coeff, -1);
-    exec_prog(code, coeff);
+    for (i = 0; i < batch->program_count; ++i)
+        load_program(batch->programs + i, opt);
+    batch->opt = opt;
+    batch->queue = xcalloc(batch->size, sizeof(size_t));
+    for (i = 0; i < batch->size; ++i)
+    {
+        batch->queue[i] = i;
+        batch->jobs[i].task = (t_task){batch->programs + batch->jobs[i].program, opt, 0, {0}, NULL, 0, !batch->jobs[i].input, opt->step_limit, NULL};
+    }
+    batch->head = 0;
+    batch->queued = batch->size;
+    batch->remaining = batch->size;
+    batch->failed = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->ready, NULL);
+
+   /*
+    * The main thread is one of the workers. If a thread can't be
+    * created, the jobs are simply shared by fewer threads.
+    */
+
+    count = count < 1 ? 1 : (size_t)count > batch->size ? (long)batch->size : count;
+    threads = xcalloc(count, sizeof(pthread_t));
+    for (n = 0; n < count - 1 && !pthread_create(threads + n, NULL, batch_worker, batch); ++n);
+    batch_worker(batch);
+    while (n--)
+        pthread_join(threads[n], NULL);
+    free(threads);
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->ready);
+    free(batch->queue);
+    for (i = 0; i < batch->program_count; ++i)
+        free_program(batch->programs + i, opt);
+    free(batch->programs);
+    free(batch->jobs);
+    free(batch->manifest);
+    return (batch->failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static const char *option_value(const char *arg, const char *option)
+{
+    size_t len = strlen(option);
+
+    return (!strncmp(arg, option, len) ? arg + len : NULL);
+}
+
+static long option_number(const char *arg, const char *value, long min)
+{
+    char *end;
+    long n = strtol(value, &end, 10);
+
+    if (!*value || *end || n < min)
+        error(ERROR_OPTION_VALUE, arg);
+    return (n);
+}
+
+int parse_option(const char *arg, t_options *opt)
+{
+    static const char *memory[5] = {"none", "extend", "abort", "wrap", "block"};
+    const char *value;
+    int i;
+
+    if (!strcmp(arg, "--jit"))
+        opt->mode = MODE_JIT;
+    else if (!strcmp(arg, "--emit-c"))
+        opt->mode = MODE_EMIT_C;
+    else if (!strcmp(arg, "--emit-asm"))
+        opt->mode = MODE_EMIT_ASM;
+    else if (!strcmp(arg, "--verify"))
+        opt->mode = MODE_VERIFY;
+    else if ((value = option_value(arg, "--fuzz=")))
+        opt->fuzz = option_number(arg, value, 0);
+    else if (!strcmp(arg, "--guard-pages"))
+        opt->guard = 1;
+    else if ((value = option_value(arg, "--cache=")))
+        opt->cache = value;
+    else if (!strcmp(arg, "--tty-flush"))
+        opt->tty_flush = 1;
+    else if (!strcmp(arg, "--time-passes"))
+        opt->time_passes = 1;
+    else if (!strcmp(arg, "--perf-stats"))
+        opt->perf_stats = 1;
+    else if ((value = option_value(arg, "--no-pass=")))
+    {
+        for (i = 0; i < PASS_COUNT && strcmp(value, passes[i].name); ++i);
+        if (i == PASS_COUNT)
+            error(ERROR_OPTION_VALUE, arg);
+        opt->passes &= ~(1u << i);
+    }
+    else if (!strcmp(arg, "--profile"))
+    {
+        if (!PROFILE)
+            error(ERROR_PROFILE);
+        opt->profile = 1;
+    }
+    else if ((value = option_value(arg, "--cell=")))
+    {
+        opt->cell_bits = option_number(arg, value, 8);
+        if (opt->cell_bits != 8 && opt->cell_bits != 16 && opt->cell_bits != 32 && opt->cell_bits != 64)
+            error(ERROR_OPTION_VALUE, arg);
+    }
+    else if ((value = option_value(arg, "--array-size=")))
+        opt->array_size = option_number(arg, value, 1);
+    else if ((value = option_value(arg, "--memory=")))
+    {
+        for (i = 0; i < 5 && strcmp(value, memory[i]); ++i);
+        if (i == 5)
+            error(ERROR_OPTION_VALUE, arg);
+        opt->memory = i;
+    }
+    else if ((value = option_value(arg, "--batch=")))
+        opt->batch = value;
+    else if ((value = option_value(arg, "--manifest=")))
+        opt->manifest = value;
+    else if ((value = option_value(arg, "--jobs=")))
+        opt->jobs = option_number(arg, value, 1);
+    else if ((value = option_value(arg, "--step-limit=")))
+        opt->step_limit = option_number(arg, value, 0);
+    else if ((value = option_value(arg, "--slice=")))
+        opt->slice = option_number(arg, value, 0);
+    else if ((value = option_value(arg, "--checkpoint=")))
+        opt->checkpoint = value;
+    else if ((value = option_value(arg, "--checkpoint-interval=")))
+        opt->checkpoint_interval = option_number(arg, value, 0);
+    else if ((value = option_value(arg, "--resume=")))
+        opt->resume = value;
+    else if ((value = option_value(arg, "--prologue-steps=")))
+        opt->prologue_steps = option_number(arg, value, 0);
+    else if ((value = option_value(arg, "--eof=")))
+        opt->eof = !strcmp(value, "no-change") ? NO_CHANGE : option_number(arg, value, NO_CHANGE + 1);
+    else
+        return (0);
+    return (1);
+}
+
+// The settings used when no option changes them, from the macros at the top of this file
+
+#define DEFAULT_OPTIONS {CELL_BITS, INITIAL_ARRAY_SIZE, MEMORY_BEHAVIOR, EOF_INPUT_BEHAVIOR, MODE_RUN, GUARD_PAGES, CACHE_DIR, 0, TTY_FLUSH, ALL_PASSES, 0, PROLOGUE_STEPS, NULL, NULL, 0, 0, 0, NULL, 0, NULL, 0, 0}
+
+void check_options(const t_options *opt)
+{
+    if (opt->array_size < 1)
+        error(ERROR_ARRAY_SIZE);
+    if (opt->guard && opt->memory != EXTEND && opt->memory != ABORT)
+        error(ERROR_GUARD_PAGES);
+    if ((opt->checkpoint || opt->resume) && (opt->batch || opt->guard || opt->mode == MODE_EMIT_C || opt->mode == MODE_EMIT_ASM))
+        error(ERROR_CHECKPOINT);
+    if (opt->checkpoint_interval && !opt->checkpoint)
+        error(ERROR_CHECKPOINT_INTERVAL);
+    if (opt->perf_stats && (opt->batch || opt->mode == MODE_EMIT_C || opt->mode == MODE_EMIT_ASM))
+        error(ERROR_PERF_STATS);
+    if (opt->fuzz && opt->mode != MODE_VERIFY)
+        error(ERROR_FUZZ);
+    if (opt->mode == MODE_JIT && (opt->batch || opt->step_limit || opt->checkpoint || opt->resume))
+        error(ERROR_JIT);
+}
+
+/*
+ * The library interface (see libsbfi.h). Each function sets error_jump
+ * while it runs, so that error comes back here with the status of the
+ * error instead of exiting. The errors raised that way are found before
+ * anything is allocated, or free what they allocated first, besides an
+ * allocation failure, which leaks what was allocated before it.
+ *
+ * The guard pages change the handler of SIGSEGV for the whole process,
+ * and the profiler counts in a global array, so they're left out,
+ * and so is the verifier, which exits with the result of the programs.
+ */
+
+static size_t read_buffer(void *ctx, char *buffer, size_t size)
+{
+    sbfi_io *io = ctx;
+
+    if (!(size = size < io->input_size ? size : io->input_size))
+        return (0);
+    memcpy(buffer, io->input, size);
+    io->input += size;
+    io->input_size -= size;
+    return (size);
+}
+
+static void write_buffer(void *ctx, const char *buffer, size_t size)
+{
+    sbfi_io *io = ctx;
+
+    io->output = xrealloc(io->output, io->output_size + size);
+    memcpy(io->output + io->output_size, buffer, size);
+    io->output_size += size;
+}
+
+static void compile_program(const char *source, size_t size, const char *const *options, sbfi_program **program)
+{
+    t_options opt = DEFAULT_OPTIONS;
+    t_src src = {(char *)source, size, 0};
+    t_program built = {NULL, NULL, {0}, NULL, 0};
+    size_t i;
+
+    for (i = 0; options && options[i]; ++i)
+        if (!parse_option(options[i], &opt))
+            error(ERROR_UNKNOWN_OPTION, options[i]);
+    check_options(&opt);
+    if (opt.guard || opt.profile || opt.batch || opt.manifest || opt.checkpoint || opt.resume || opt.perf_stats || opt.mode == MODE_EMIT_C || opt.mode == MODE_EMIT_ASM
+        || opt.mode == MODE_VERIFY)
+        error(ERROR_LIBRARY);
+    build_program(&built, &src, &opt);
+
+    // The options only have to live during the compilation, the cache directory isn't needed anymore
+
+    opt.cache = NULL;
+    *program = xcalloc(1, sizeof(sbfi_program));
+    (*program)->program = built;
+    (*program)->opt = opt;
+}
+
+int sbfi_compile(const char *source, size_t size, const char *const *options, sbfi_program **program)
+{
+    jmp_buf jump;
+    int status;
+
+    *program = NULL;
+    if (!(status = setjmp(jump)))
+    {
+        error_jump = &jump;
+        compile_program(source, size, options, program);
+    }
+    error_jump = NULL;
+    return (status);
+}
+
+// The input and the output of a run go through io, until they're reset
+
+static void set_io(sbfi_io *io)
+{
+    input.read = io->read ? io->read : read_buffer;
+    input.ctx = io->read ? io->ctx : io;
+    output.write = io->write ? io->write : write_buffer;
+    output.ctx = io->write ? io->ctx : io;
+}
+
+static void reset_io(void)
+{
+    input.read = NULL;
+    output.write = NULL;
+}
+
+int sbfi_run(const sbfi_program *program, sbfi_io *io, uint64_t step_limit)
+{
+    t_options opt = program->opt;
+    jmp_buf jump;
+    int status;
+
+    set_io(io);
+    input.index = 0;
+    input.size = 0;
+    input.eof = 0;
+    opt.step_limit = step_limit;
+    if (!(status = setjmp(jump)))
+    {
+        error_jump = &jump;
+        status = run_program(&program->program, &program->program.start, NULL, &opt);
+    }
+    error_jump = NULL;
+    reset_io();
+    return (status);
+}
+
+int sbfi_start(const sbfi_program *program, sbfi_task **task)
+{
+    if (!(*task = calloc(1, sizeof(sbfi_task))))
+        return (fail(SBFI_ERROR_ALLOC, ERROR_ALLOC));
+    (*task)->task.program = &program->program;
+    (*task)->task.opt = &program->opt;
+    return (SBFI_OK);
+}
+
+int sbfi_resume(sbfi_task *task, sbfi_io *io, uint64_t step_limit)
+{
+    jmp_buf jump;
+    int status;
+
+    set_io(io);
+    if (!(status = setjmp(jump)))
+    {
+        error_jump = &jump;
+        status = resume_task(&task->task, step_limit);
+    }
+    error_jump = NULL;
+    reset_io();
+    return (status);
+}
+
+void sbfi_task_free(sbfi_task *task)
+{
+    if (!task)
+        return;
+    free_task(&task->task);
+    free(task);
+}
+
+void sbfi_free(sbfi_program *program)
+{
+    if (!program)
+        return;
+    free_program(&program->program, &program->opt);
+    free(program);
+}
+
+const char *sbfi_error(void)
+{
+    return (error_message);
+}
+
+/*
+ * The verifier runs each program with each memory behavior, and
+ * compares the run of the bytecode with the one of the reference
+ * interpreter (see run_reference), which is as naive as it gets : it
+ * executes the commands of the source one at a time, on uint64_t
+ * cells masked to the size of a cell. The optimizer, the prologue and
+ * exec_prog must never change what a program does, so any difference
+ * in the status, the output, the position of the pointer or the cells
+ * is a bug of one of them. Without checking, the output of the JIT is
+ * compared too, and since its cells end against a page which can't be
+ * accessed, a small array also catches the cells it touches past the
+ * end (see jit_prog), such as the ones of a movecell on a zero cell.
+ *
+ * The runs the reference can't decide are skipped : the ones which
+ * take too many loop iterations, and the ones reaching a cell outside
+ * the array without checking. An aborted run is only compared up to
+ * its output, since a folded loop clears its counter before the
+ * pointer reaches the bound. The bytecode never takes more loop
+ * iterations than the source, so it's stopped right after the ones
+ * the reference took, and a bytecode which loops forever fails too.
+ */
+
+static void reference_move(t_reference *ref, int shift, const t_options *opt)
+{
+    long pos = ref->pos + shift;
+    long first = ref->first;
+    uint64_t *cells;
+
+    if (pos >= ref->first && pos < ref->first + (long)ref->size)
+        ref->pos = pos;
+    else if (opt->memory == EXTEND)
+    {
+        first -= pos < ref->first ? (long)ref->size : 0;
+        cells = xcalloc(ref->size * 2, sizeof(uint64_t));
+        memcpy(cells + (ref->first - first), ref->cells, ref->size * sizeof(uint64_t));
+        free(ref->cells);
+        ref->cells = cells;
+        ref->first = first;
+        ref->size *= 2;
+        ref->pos = pos;
+    }
+    else if (opt->memory == WRAP)
+        ref->pos = pos < 0 ? (long)ref->size - 1 : 0;
+    else if (opt->memory == ABORT)
+        ref->status = SBFI_ERROR_MEMORY;
+    else if (opt->memory == NONE)
+        ref->undefined = 1;
+}
+
+void run_reference(t_reference *ref, const t_src *src, const unsigned char *in, size_t in_size, const t_options *opt)
+{
+    uint64_t mask = opt->cell_bits == 64 ? UINT64_MAX : ((uint64_t)1 << opt->cell_bits) - 1;
+    uint64_t limit = opt->step_limit ? opt->step_limit : VERIFY_STEPS;
+    char *code = xcalloc(src->size + 1, sizeof(char));
+    size_t *jump = xcalloc(src->size + 1, sizeof(size_t));
+    size_t *left = xcalloc(src->size + 1, sizeof(size_t));
+    size_t size = 0;
+    size_t n = 0;
+    size_t i;
+    uint64_t *cell;
+
+    *ref = (t_reference){SBFI_OK, 0, 0, 0, xcalloc(opt->array_size, sizeof(uint64_t)), 0, opt->array_size, NULL, 0, 0};
+
+    // Only the commands are kept, and each bracket jumps to its counterpart
+
+    for (i = 0; i < src->size; ++i)
+    {
+        if (!strchr("+-<>[].,", src->code[i]) || !src->code[i])
+            continue;
+        if (src->code[i] == '[')
+            left[n++] = size;
+        else if (src->code[i] == ']' && n)
+        {
+            jump[size] = left[--n];
+            jump[left[n]] = size;
+        }
+        else if (src->code[i] == ']')
+            ref->status = SBFI_ERROR_BRACKETS;
+        code[size++] = src->code[i];
+    }
+    if (n)
+        ref->status = SBFI_ERROR_BRACKETS;
+
+    for (i = 0; i < size && ref->status == SBFI_OK && !ref->undefined; ++i)
+    {
+        cell = ref->cells + (ref->pos - ref->first);
+        if (code[i] == '+')
+            *cell = (*cell + 1) & mask;
+        else if (code[i] == '-')
+            *cell = (*cell - 1) & mask;
+        else if (code[i] == '>' || code[i] == '<')
+            reference_move(ref, code[i] == '>' ? 1 : -1, opt);
+        else if (code[i] == '[' && !*cell)
+            i = jump[i];
+        else if (code[i] == ']' && *cell && ++ref->steps == limit)
+            ref->status = SBFI_STEP_LIMIT;
+        else if (code[i] == ']' && *cell)
+            i = jump[i];
+        else if (code[i] == '.')
+        {
+            if (ref->output_size == ref->output_capacity)
+                ref->output = xrealloc(ref->output, ref->output_capacity = ref->output_capacity * 2 + OUTPUT_SIZE);
+            ref->output[ref->output_size++] = (char)*cell;
+        }
+        else if (code[i] == ',' && in_size)
+        {
+            *cell = *in++;
+            --in_size;
+        }
+        else if (code[i] == ',' && opt->eof != NO_CHANGE)
+            *cell = (uint64_t)(int64_t)opt->eof & mask;
+    }
     free(code);
-    free(coeff);
-    free(mov);
+    free(jump);
+    free(left);
+}
+
+static uint64_t cell_value(const void *cells, size_t i, size_t cell)
+{
+    return (cell == 1 ? ((const uint8_t *)cells)[i] : cell == 2 ? ((const uint16_t *)cells)[i]
+        : cell == 4 ? ((const uint32_t *)cells)[i] : ((const uint64_t *)cells)[i]);
+}
+
+// tape_cell reads a cell of the tape without allocating its page, which is zero if it doesn't exist
+
+static uint64_t tape_cell(const t_tape *tape, long pos)
+{
+    long page = pos >> TAPE_PAGE_BITS;
+    long table = page >> TAPE_TABLE_BITS;
+    void **pages;
+
+    if (table < tape->first || table >= tape->first + (long)tape->count || !(pages = tape->tables[table - tape->first])
+        || !pages[page & (TAPE_TABLE_SIZE - 1)])
+        return (0);
+    return (cell_value(pages[page & (TAPE_TABLE_SIZE - 1)], pos & (TAPE_PAGE_CELLS - 1), tape->cell));
+}
+
+// With EXTEND, the cells of the tape which the reference never reached must still be zero
+
+static int same_cells(const t_state *stop, const t_reference *ref, size_t cell)
+{
+    const t_tape *tape = stop->pages;
+    size_t i;
+    long j;
+    long k;
+    long pos;
+
+    if (!tape && stop->cells != ref->size)
+        return (0);
+    for (i = 0; i < ref->size; ++i)
+        if (ref->cells[i] != (tape ? tape_cell(tape, ref->first + (long)i) : cell_value(stop->tape, i, cell)))
+            return (0);
+    for (i = 0; tape && i < tape->count; ++i)
+        for (j = 0; tape->tables[i] && j < TAPE_TABLE_SIZE; ++j)
+            for (k = 0; tape->tables[i][j] && k < TAPE_PAGE_CELLS; ++k)
+            {
+                pos = ((tape->first + (long)i) * TAPE_TABLE_SIZE + j) * TAPE_PAGE_CELLS + k;
+                if ((pos < ref->first || pos >= ref->first + (long)ref->size) && cell_value(tape->tables[i][j], k, cell))
+                    return (0);
+            }
+    return (1);
+}
+
+// run_io runs a program with the given input, and collects its output in io
+
+static int run_io(const t_program *program, sbfi_io *io, t_state *stop, const t_options *opt)
+{
+    int status;
+
+    set_io(io);
+    input.index = 0;
+    input.size = 0;
+    input.eof = 0;
+    status = run_program(program, &program->start, stop, opt);
+    reset_io();
+    return (status);
+}
+
+// verify_bytecode returns what differs between the runs of the bytecode and of the reference, or NULL
+
+static const char *verify_bytecode(const t_program *program, const t_reference *ref, const unsigned char *in, size_t in_size, const t_options *opt)
+{
+    t_options run = *opt;
+    sbfi_io io = {NULL, (const char *)in, in_size, NULL, NULL, 0, NULL};
+    t_state stop = {0};
+    const char *diff = NULL;
+    int status;
+
+    run.step_limit = ref->steps + 1;
+    status = run_io(program, &io, &stop, &run);
+    if (status != ref->status)
+        diff = "status";
+    else if (io.output_size != ref->output_size || (io.output_size && memcmp(io.output, ref->output, io.output_size)))
+        diff = "output";
+    else if (status == SBFI_OK && (long)stop.pos != ref->pos)
+        diff = "pointer";
+    else if (status == SBFI_OK && !same_cells(&stop, ref, opt->cell_bits / 8))
+        diff = "cells";
+    if (stop.pages)
+        free_tape(stop.pages);
+    else
+        free(stop.tape);
+    free(io.output);
+    if (diff || opt->memory != NONE)
+        return (diff);
+
+    // The JIT falls back to the interpreter where it isn't supported, and can't stop early
+
+    run.mode = MODE_JIT;
+    run.step_limit = 0;
+    io = (sbfi_io){NULL, (const char *)in, in_size, NULL, NULL, 0, NULL};
+    run_io(program, &io, NULL, &run);
+    if (io.output_size != ref->output_size || (io.output_size && memcmp(io.output, ref->output, io.output_size)))
+        diff = "output with the JIT";
+    free(io.output);
+    return (diff);
+}
+
+static int verify_build(t_program *program, const t_src *src, const t_options *opt)
+{
+    jmp_buf jump;
+    int status;
+
+    if (!(status = setjmp(jump)))
+    {
+        error_jump = &jump;
+        build_program(program, src, opt);
+    }
+    error_jump = NULL;
+    return (status);
+}
+
+/*
+ * verify_program verifies a program with each memory behavior, and
+ * prints each difference it finds. A source with unmatched brackets
+ * has to be rejected by both interpreters.
+ */
+
+void verify_program(t_verify *verify, const char *name, const t_src *src, const unsigned char *in, size_t in_size, const t_options *opt)
+{
+    static const char *memory[5] = {"none", "extend", "abort", "wrap", "block"};
+    t_options run = *opt;
+    t_program program = {name, NULL, {0}, NULL, 0};
+    t_reference ref;
+    const char *diff;
+    int status;
+
+    ++verify->programs;
+    for (run.memory = NONE; run.memory <= BLOCK; ++run.memory)
+    {
+        run_reference(&ref, src, in, in_size, &run);
+        status = verify_build(&program, src, &run);
+        diff = status != (ref.status == SBFI_ERROR_BRACKETS ? ref.status : SBFI_OK) ? "status" : NULL;
+        if (!status && (ref.undefined || ref.status == SBFI_STEP_LIMIT))
+            ++verify->skipped;
+        else
+        {
+            ++verify->runs;
+            if (!status && !diff)
+                diff = verify_bytecode(&program, &ref, in, in_size, &run);
+        }
+        if (!status)
+            free_program(&program, &run);
+        if (diff)
+        {
+            ++verify->failed;
+            fprintf(stderr, "Verify : %s with --memory=%s : different %s\n", name, memory[run.memory], diff);
+        }
+        free(ref.cells);
+        free(ref.output);
+    }
+}
+
+/*
+ * The random programs of --fuzz=N are made of the patterns the passes
+ * look for : runs of commands, clears, scans and multiplication loops,
+ * with odd counters and mixed movements, some of which go out of the
+ * loop's cells and back, along with other loops which begin by
+ * decrementing their cell, so that most of them end. The n-th program
+ * only depends on n, so that a failure can be reproduced.
+ */
+
+static uint64_t fuzz_random(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return (*seed * 0x2545F4914F6CDD1D);
+}
+
+static void fuzz_put(t_src *src, size_t *capacity, char c, int count)
+{
+    while (count-- > 0)
+    {
+        if (src->size == *capacity)
+            src->code = xrealloc(src->code, *capacity = *capacity * 2 + CHUNK_SIZE);
+        src->code[src->size++] = c;
+    }
+}
+
+static void fuzz_block(t_src *src, size_t *capacity, uint64_t *seed, int depth)
+{
+    int items = fuzz_random(seed) % 8;
+    uint64_t r;
+    int offset;
+    int shift;
+    int n;
+
+    while (items--)
+    {
+        r = fuzz_random(seed);
+        switch (r % (depth < FUZZ_DEPTH ? 8 : 7))
+        {
+            case 0:
+                fuzz_put(src, capacity, r & 8 ? '+' : '-', 1 + (r >> 4) % 5);
+                break;
+            case 1:
+                fuzz_put(src, capacity, r & 8 ? '>' : '<', 1 + (r >> 4) % 4);
+                fuzz_put(src, capacity, r & 8 ? '<' : '>', (r >> 8) % 3);
+                break;
+            case 2:
+                fuzz_put(src, capacity, '.', 1);
+                break;
+            case 3:
+                fuzz_put(src, capacity, ',', 1);
+                break;
+            case 4:
+                fuzz_put(src, capacity, '[', 1);
+                fuzz_put(src, capacity, r & 8 ? '+' : '-', r & 16 ? 3 : 1);
+                fuzz_put(src, capacity, ']', 1);
+                break;
+            case 5:
+                fuzz_put(src, capacity, '[', 1);
+                fuzz_put(src, capacity, r & 8 ? '>' : '<', 1 + (r >> 4) % 4);
+                fuzz_put(src, capacity, ']', 1);
+                break;
+            case 6:
+                fuzz_put(src, capacity, '[', 1);
+                fuzz_put(src, capacity, r & 8 ? '+' : '-', r & 16 ? 3 : 1);
+                for (n = 1 + (r >> 5) % 3, offset = 0; n; --n)
+                {
+                    r = fuzz_random(seed);
+                    shift = (int)(r % 7) - 3;
+                    fuzz_put(src, capacity, shift > 0 ? '>' : '<', shift ? abs(shift) : 1);
+                    offset += shift ? shift : -1;
+                    fuzz_put(src, capacity, r & 8 ? '+' : '-', 1 + (r >> 4) % 3);
+                    if (r & 64)
+                    {
+                        fuzz_put(src, capacity, r & 128 ? '>' : '<', 1 + (r >> 8) % 3);
+                        fuzz_put(src, capacity, r & 128 ? '<' : '>', 1 + (r >> 8) % 3);
+                    }
+                }
+                fuzz_put(src, capacity, offset > 0 ? '<' : '>', abs(offset));
+                fuzz_put(src, capacity, ']', 1);
+                break;
+            default:
+                fuzz_put(src, capacity, '[', 1);
+                fuzz_put(src, capacity, '-', r & 8 ? 1 : 0);
+                fuzz_block(src, capacity, seed, depth + 1);
+                fuzz_put(src, capacity, ']', 1);
+                break;
+        }
+    }
+}
+
+// Each random program begins a few cells to the right, and reads a few random bytes
+
+static void fuzz_program(t_src *src, size_t *capacity, unsigned char *in, size_t *in_size, size_t n)
+{
+    uint64_t seed = 0x9E3779B97F4A7C15 * (n + 1);
+    size_t i;
+
+    src->size = 0;
+    fuzz_put(src, capacity, '>', fuzz_random(&seed) % 8);
+    fuzz_block(src, capacity, &seed, 0);
+    *in_size = fuzz_random(&seed) % 8;
+    for (i = 0; i < *in_size; ++i)
+        in[i] = fuzz_random(&seed);
+}
+
+/*
+ * run_verify verifies the programs given on the command line, with an
+ * empty input, the ones of the manifest with their input file, then
+ * --fuzz=N random programs, and returns the exit status of sbfi.
+ */
+
+int run_verify(t_batch *batch, const t_options *opt)
+{
+    t_verify verify = {0, 0, 0, 0};
+    t_src src;
+    t_src in = {NULL, 0, 0};
+    unsigned char random[8];
+    char name[64];
+    size_t capacity = 0;
+    size_t failed;
+    size_t i;
+
+    if (opt->guard || opt->profile || opt->batch || opt->checkpoint || opt->resume || opt->perf_stats)
+        error(ERROR_VERIFY);
+    if (!batch->size && !opt->fuzz)
+        error(ERROR_NO_ARGS);
+    for (i = 0; i < batch->size; ++i)
+    {
+        src = get_src(batch->programs[batch->jobs[i].program].filename);
+        if (batch->jobs[i].input)
+            in = get_src(batch->jobs[i].input);
+        verify_program(&verify, batch->programs[batch->jobs[i].program].filename, &src, (unsigned char *)in.code, in.size, opt);
+        free_src(&src);
+        if (batch->jobs[i].input)
+            free_src(&in);
+        in = (t_src){NULL, 0, 0};
+    }
+    src = (t_src){NULL, 0, 0};
+    for (i = 0; i < (size_t)opt->fuzz; ++i)
+    {
+        fuzz_program(&src, &capacity, random, &in.size, i);
+        snprintf(name, sizeof(name), "random program %zu", i + 1);
+        failed = verify.failed;
+        verify_program(&verify, name, &src, random, in.size, opt);
+        if (verify.failed != failed)
+            fprintf(stderr, "Verify : %s is %.*s\n", name, (int)src.size, src.code);
+    }
+    free(src.code);
+    free(batch->programs);
+    free(batch->jobs);
+    free(batch->manifest);
+    fprintf(stderr, "Verify : %zu programs, %zu runs, %zu skipped, %zu failed\n",
+        verify.programs, verify.runs, verify.skipped, verify.failed);
+    return (verify.failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+#if !(SBFI_LIBRARY)
+int main(int ac, char **av)
+{
+    t_options opt = DEFAULT_OPTIONS;
+    t_batch batch = {0};
+    t_program program;
+    int status;
+    int i;
+
+   /*
+    * Usage: ./sbfi [options] filename
+    *        ./sbfi --batch=DIR [--manifest=FILE] [--jobs=N] [options] [filenames...]
+    *        ./sbfi --verify [--manifest=FILE] [--fuzz=N] [options] [filenames...]
+    *
+    * --jit, --emit-c, --emit-asm       what to do with the program (--jit runs a single program to its end)
+    * --cell=8|16|32|64                 the size of a cell in bits
+    * --array-size=N                    the initial number of cells
+    * --memory=none|extend|abort|wrap|block
+    * --eof=no-change|N                 the cell value on EOF
+    * --guard-pages                     check the bounds with guard pages
+    * --cache=DIR                       cache the bytecode in DIR
+    * --profile                         print the hottest loops on exit
+    * --tty-flush                       flush before reading only for a terminal
+    * --no-pass=NAME                    disable a pass of the optimizer
+    * --time-passes                     print the time taken by each pass
+    * --perf-stats                      print the hardware counters of each phase as JSON
+    * --prologue-steps=N                run at most N instructions while building
+    * --batch=DIR                       run many jobs, writing their outputs in DIR
+    * --manifest=FILE                   add the jobs listed in FILE to the batch
+    * --jobs=N                          run the batch on N threads
+    * --step-limit=N                    stop the programs after N loop iterations
+    * --slice=N                         run the jobs of the batch N loop iterations at a time
+    * --checkpoint=FILE                 write a checkpoint to FILE on SIGUSR1
+    * --checkpoint-interval=N           also write it every N seconds
+    * --resume=FILE                     resume the program from the checkpoint FILE
+    * --verify                          compare the programs with the reference interpreter
+    * --fuzz=N                          also verify N random programs
+    */
+
+    for (i = 1; i < ac; ++i)
+    {
+        if (parse_option(av[i], &opt))
+            continue;
+        else if (!strncmp(av[i], "--", 2))
+            error(ERROR_UNKNOWN_OPTION, av[i]);
+        else
+            add_job(&batch, av[i], NULL);
+    }
+    if (opt.manifest && !opt.batch && opt.mode != MODE_VERIFY)
+        error(ERROR_MANIFEST, opt.manifest);
+    if (!opt.batch && opt.mode != MODE_VERIFY && batch.size != 1)
+        error(batch.size ? ERROR_TOO_MANY_ARGS : ERROR_NO_ARGS);
+
+    check_options(&opt);
+
+    if (opt.mode == MODE_VERIFY)
+    {
+        if (opt.manifest)
+            read_manifest(&batch, opt.manifest);
+        return (run_verify(&batch, &opt));
+    }
+
+    // The compilers print the whole program, and the profiler counts every instruction
+
+    if (opt.mode == MODE_EMIT_C || opt.mode == MODE_EMIT_ASM || opt.profile)
+        opt.prologue_steps = 0;
+
+    if (opt.batch)
+    {
+        if (opt.manifest)
+            read_manifest(&batch, opt.manifest);
+        return (run_batch(&batch, &opt));
+    }
+    program = batch.programs[0];
+    free(batch.programs);
+    free(batch.jobs);
+    if (opt.perf_stats)
+        perf_open();
+    load_program(&program, &opt);
+    perf_phase(PERF_RUN, &opt);
+
+    // The JIT falls back to the interpreter if it isn't supported, or to count the instructions for the profiler
+
+    if (opt.mode == MODE_EMIT_C)
+        emit_c(program.prog, &opt);
+    else if (opt.mode == MODE_EMIT_ASM)
+        emit_asm(program.prog, &opt);
+    else if (opt.checkpoint || opt.resume ? (status = run_checkpoints(&program, &opt))
+        : !(opt.mode == MODE_JIT && !opt.profile && jit_prog(program.prog, &program.start, &opt))
+        && (status = exec_prog(program.prog, &program.start, NULL, &opt)))
+    {
+        if (status == SBFI_STEP_LIMIT)
+            error(ERROR_STEP_LIMIT, (unsigned long long)opt.step_limit);
+        die();
+    }
+    perf_phase(-1, &opt);
+    if (opt.perf_stats)
+        perf_report(program.filename, &opt);
+#if (PROFILE)
+    if (opt.profile && opt.mode != MODE_EMIT_C && opt.mode != MODE_EMIT_ASM)
+        print_profile(program.prog);
+#endif
+    free_program(&program, &opt);
     return (EXIT_SUCCESS);
 }
+#endif
@@ -8,17 +8,67 @@
 #include <string.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+#endif
+
+#include "libsbfi.h"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
 
 // Error messages
 
 #define ERROR_NO_ARGS       "you must specify a file"
 #define ERROR_TOO_MANY_ARGS "you can't specify more than one file"
+#define ERROR_UNKNOWN_OPTION "unknown option %s"
+#define ERROR_OPTION_VALUE  "invalid value for the option %s"
 #define ERROR_ALLOC         "the memory could not be allocated"
 #define ERROR_OPEN_FILE     "the file %s could not be opened"
 #define ERROR_READ_FILE     "the file %s could not be read"
+#define ERROR_WRITE         "the output could not be written"
 #define ERROR_ARRAY_SIZE    "the initial array size must be at least 1 cell"
-#define ERROR_BRACKETS      "unmatched bracket at position %d"
-#define ERROR_MEMORY        "attempt to reach the cell %d which is outside of the memory (0 - %d)"
+#define ERROR_BRACKETS      "unmatched bracket at position %zu"
+#define ERROR_MEMORY        "attempt to reach the cell %ld which is outside of the memory (0 - %ld)"
+#define ERROR_EMIT_ASM      "the assembly output only supports the NONE memory behavior"
+#define ERROR_PROFILE       "the profiler needs sbfi to be compiled with PROFILE set to 1"
+#define ERROR_GUARD_PAGES   "the guard pages only support the EXTEND and ABORT memory behaviors"
+#define ERROR_BATCH         "the batch mode only runs the programs, without guard pages or the profiler"
+#define ERROR_MANIFEST      "the manifest %s needs the batch mode (--batch=DIR) or the verifier (--verify)"
+#define ERROR_MANIFEST_LINE "invalid job at line %d of the manifest %s"
+#define ERROR_STEP_LIMIT    "the program was stopped after %llu loop iterations"
+#define ERROR_LIBRARY       "the library only runs the programs, without guard pages, the profiler, the batch mode, checkpoints, performance counters or the verifier"
+#define ERROR_CHECKPOINT    "the checkpoints only support running a single program, without guard pages"
+#define ERROR_CHECKPOINT_INTERVAL "the checkpoint interval needs a checkpoint file (--checkpoint=FILE)"
+#define ERROR_CHECKPOINT_FILE "the checkpoint %s doesn't match this program"
+#define ERROR_CHECKPOINT_WRITE "the checkpoint %s could not be written"
+#define ERROR_PERF_STATS    "the performance counters only measure a single program which is run"
+#define ERROR_VERIFY        "the verifier only runs the programs, without guard pages, the profiler, the batch mode, checkpoints or performance counters"
+#define ERROR_FUZZ          "the random programs (--fuzz=N) need the verifier (--verify)"
+#define ERROR_JIT           "the JIT only runs a single program to its end, without the batch mode, a step limit or checkpoints"
+
+// The value of EOF_INPUT_BEHAVIOR that leaves the cell unchanged
+
+#define NO_CHANGE INT_MIN
 
 // Possible values for the MEMORY_BEHAVIOR macro
 
@@ -28,31 +78,584 @@
 #define WRAP    3
 #define BLOCK   4
 
-#if (MEMORY_BEHAVIOR == EXTEND)
-    #define MOVE_POINTER extend_memory(&ptr0, &ptr, &array_size, mov[++i]);
-#elif (MEMORY_BEHAVIOR == ABORT)
-    #define MOVE_POINTER abort_memory(ptr0, &ptr, array_size, mov[++i]);
-#elif (MEMORY_BEHAVIOR == WRAP)
-    #define MOVE_POINTER wrap_memory(ptr0, &ptr, array_size, mov[++i]);
-#elif (MEMORY_BEHAVIOR == BLOCK)
-    #define MOVE_POINTER block_memory(ptr0, &ptr, array_size, mov[++i]);
-#else
-    #define MOVE_POINTER ptr += mov[++i];
+// The exec_prog used for EXTEND and ABORT with guard pages (see exec.h)
+
+#define GUARDED 5
+
+// The source of the program, mapped in memory if it's a regular file
+
+typedef struct s_src
+{
+    char *code;
+    size_t size;
+    int mapped;
+}   t_src;
+
+// The settings chosen on the command line
+
+typedef struct s_options
+{
+    int cell_bits;
+    size_t array_size;
+    int memory;
+    int eof;
+    int mode;
+    int guard;
+    const char *cache;
+    int profile;
+    int tty_flush;
+    unsigned passes;
+    int time_passes;
+    long prologue_steps;
+    const char *batch;
+    const char *manifest;
+    long jobs;
+    uint64_t step_limit;
+    uint64_t slice;
+    const char *checkpoint;
+    long checkpoint_interval;
+    const char *resume;
+    int perf_stats;
+    long fuzz;
+}   t_options;
+
+// What to do with the program, chosen on the command line
+
+#define MODE_RUN        0
+#define MODE_JIT        1
+#define MODE_EMIT_C     2
+#define MODE_EMIT_ASM   3
+#define MODE_VERIFY     4
+
+// Possible values for the DISPATCH macro
+
+#define COMPUTED_GOTO   0
+#define DIRECT_THREADED 1
+
+/*
+ * A bytecode instruction : the opcode, the pointer movement done
+ * before executing it, and its coeff, packed together in 8 bytes
+ * so that exec_prog only reads a single array. The movement is
+ * thus limited to MOV_MAX cells in each direction.
+ *
+ * With direct threading, the instruction also holds the address
+ * of the label that executes it, which makes it 16 bytes long.
+ */
+
+typedef struct s_instr
+{
+#if (DISPATCH == DIRECT_THREADED)
+    const void *label;
 #endif
+    int op    : 8;
+    int mov   : 24;
+    int coeff;
+}   t_instr;
+
+#define MOV_MAX ((1 << 23) - 1)
+
+/*
+ * The opcodes of the bytecode instructions (see optim_code). OP_SHIFT
+ * only exists in the IR : it moves the pointer, and is merged into
+ * the mov of the next node by the moves pass.
+ */
+
+#define OP_END              0
+#define OP_CHANGE           1
+#define OP_LEFT             2
+#define OP_RIGHT            3
+#define OP_ZERO             4
+#define OP_SEEK             5
+#define OP_MOVE             6
+#define OP_OUTPUT           7
+#define OP_INPUT            8
+#define OP_MUL              9
+#define OP_CHANGEOFFSET     10
+#define OP_ZEROOFFSET       11
+#define OP_PAIR             12
+#define OP_SET              13
+#define OP_CHANGEBRANCH     14
+#define OP_OFFSETBRANCH     15
+#define OP_ZEROBRANCH       16
+#define OP_SHIFT            17
+
+/*
+ * The classes of the innermost loops (see classify_loop). A clear
+ * becomes OP_ZERO, a scan OP_SEEK, and a transfer (a multiplication
+ * loop touching a single other cell) or a multiplication OP_MOVE or
+ * OP_MUL. The other loops are left as they are.
+ */
+
+#define LOOP_OTHER          0
+#define LOOP_CLEAR          1
+#define LOOP_SCAN           2
+#define LOOP_TRANSFER       3
+#define LOOP_MULTIPLY       4
+#define LOOP_CLASSES        5
+
+/*
+ * The intermediate representation of the program, which the passes of
+ * optim_code transform : a vector of size nodes followed by an OP_END
+ * node, each one with its opcode, the pointer movement done before it,
+ * its coeff, and the position in the source it comes from. depth is
+ * the deepest nesting of loops.
+ *
+ * The movement has the same 24 bits as the one of an instruction, and
+ * the position wraps past 4 GiB, since only the profiler reads it, so
+ * that a node takes 12 bytes : the front end needs one per command of
+ * the source at first.
+ */
+
+typedef struct s_node
+{
+    int op : 8;
+    int mov : 24;
+    int coeff;
+    uint32_t pos;
+}   t_node;
+
+typedef struct s_ir
+{
+    t_node *node;
+    size_t size;
+    size_t depth;
+}   t_ir;
+
+// A pass of the optimizer, and the bits of opt->passes enabling them
+
+typedef struct s_pass
+{
+    const char *name;
+    void (*run)(t_ir *ir, const t_options *opt);
+}   t_pass;
+
+#define PASS_RUNS   0
+#define PASS_COUNT  8
+#define ALL_PASSES  ((1u << PASS_COUNT) - 1)
+
+/*
+ * The offset instructions (o and z) work on the cell at some offset
+ * from the pointer, without moving it. For o, the offset and the
+ * value added to the cell share the coeff, 16 bits each.
+ */
+
+#define OFFSET_MAX                  INT16_MAX
+#define PACK_OFFSET(offset, value)  ((int)((uint32_t)(offset) << 16 | (uint16_t)(value)))
+#define OFFSET(coeff)               ((coeff) >> 16)
+#define OFFSET_VALUE(coeff)         ((int16_t)(coeff))
+
+// SHIFT_POINTER depends on the memory behavior, see exec.h
+
+#define MOVE_POINTER SHIFT_POINTER(prog[++i].mov)
+
+/*
+ * CHUNK_SIZE is the size of the chunks in which the source is read.
+ * OUTPUT_SIZE and INPUT_SIZE are the sizes of the output and input
+ * buffers, large enough so that programs processing large streams
+ * don't make a syscall for every few bytes.
+ */
+
+#define CHUNK_SIZE  1024
+#define OUTPUT_SIZE (1 << 16)
+#define INPUT_SIZE  (1 << 16)
+#define PRINT_BUFFER(size) { write_output(buffer, size); buffer_index = 0; }
+
+/*
+ * The input buffer, filled by fill_input when the program has read
+ * all of it, from fd or with the read callback of the library if it's
+ * set. Once the end of the input is reached, eof is set and the input
+ * isn't read anymore, like with getchar.
+ */
+
+typedef struct s_input
+{
+    unsigned char buffer[INPUT_SIZE];
+    size_t index;
+    size_t size;
+    int eof;
+    int fd;
+    size_t (*read)(void *ctx, char *buffer, size_t size);
+    void *ctx;
+}   t_input;
+
+// Where write_output writes : fd, or the write callback of the library if it's set
+
+typedef struct s_output
+{
+    int fd;
+    void (*write)(void *ctx, const char *buffer, size_t size);
+    void *ctx;
+}   t_output;
+
+// The output buffer, the cell array and the generated code used by the JIT compiler
+
+typedef struct s_jit_io
+{
+    char buffer[OUTPUT_SIZE];
+    int buffer_index;
+    int flush;
+    uint8_t *ptr0;
+    uint8_t *end;
+    size_t cell;
+    int eof;
+}   t_jit_io;
+
+typedef struct s_jit
+{
+    unsigned char *code;
+    size_t size;
+    size_t capacity;
+    size_t cell;
+}   t_jit;
+
+/*
+ * The paged tape of EXTEND (see tape_page) : pages of TAPE_PAGE_CELLS
+ * cells, allocated the first time they're reached, in tables of
+ * TAPE_TABLE_SIZE pages. The directory holds the tables from the
+ * first one, which can be negative, so that the tape extends on
+ * both sides without moving any cell.
+ */
+
+#define TAPE_PAGE_BITS      16
+#define TAPE_PAGE_CELLS     (1L << TAPE_PAGE_BITS)
+#define TAPE_TABLE_BITS     12
+#define TAPE_TABLE_SIZE     (1L << TAPE_TABLE_BITS)
+
+typedef struct s_tape
+{
+    void ***tables;
+    long first;
+    size_t count;
+    size_t cell;
+}   t_tape;
+
+/*
+ * A state the program starts from : the instruction to resume from,
+ * the position of the pointer, the first cells cells of the array
+ * (the other ones are still zero), and the output written so far.
+ * It's either the end of the prologue, evaluated while the bytecode
+ * is built (see eval_prologue), or where a run was suspended by its
+ * step limit (see exec_prog). A run suspended with EXTEND keeps its
+ * paged tape in pages instead, and pos can then be negative. jumps
+ * is the number of loop iterations the prologue ran, which are
+ * charged to the step limit of the runs starting from it.
+ */
+
+typedef struct s_state
+{
+    size_t ip;
+    size_t pos;
+    size_t cells;
+    void *tape;
+    size_t output_size;
+    char *output;
+    t_tape *pages;
+    uint64_t jumps;
+}   t_state;
+
+/*
+ * The header of the image of a program, followed by the count
+ * instructions of the program, then by the cells and the output
+ * of its prologue. A bytecode cache file holds the same image.
+ * key is the hash of the source and of the settings, size the
+ * size of the source.
+ */
+
+#define CACHE_MAGIC     "SBFI"
+#define CACHE_VERSION   8
+
+typedef struct s_cache
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t size;
+    uint64_t count;
+    uint64_t ip;
+    uint64_t pos;
+    uint64_t cells;
+    uint64_t output_size;
+    uint64_t jumps;
+}   t_cache;
+
+/*
+ * A program, with its image (see build_program), which is mapped
+ * from the cache file its bytecode comes from if mapped is set, and a
+ * job of the batch mode : the index of its program, the file it reads
+ * its input from, or NULL for an empty input, and its run.
+ */
+
+typedef struct s_program
+{
+    const char *filename;
+    t_instr *prog;
+    t_state start;
+    t_cache *image;
+    int mapped;
+}   t_program;
+
+// A program compiled by the library, with the options it runs with
+
+struct sbfi_program
+{
+    t_program program;
+    t_options opt;
+};
+
+/*
+ * A run of a program which can be suspended by its step limit, then
+ * resumed later from any thread (see resume_task). Once it has run,
+ * state owns its cell array, and is where it resumes from if it was
+ * suspended. input holds what was read from the input but not
+ * consumed yet, and left the number of loop iterations the run can
+ * still do (0 for no limit). prog is the bytecode the task runs, set
+ * when it first runs, which is its own copy with direct threading, so
+ * that it's only threaded once (see run_prog).
+ */
+
+typedef struct s_task
+{
+    const t_program *program;
+    const t_options *opt;
+    int suspended;
+    t_state state;
+    unsigned char *input;
+    size_t input_size;
+    int eof;
+    uint64_t left;
+    t_instr *prog;
+}   t_task;
+
+/*
+ * The header of a checkpoint file (see save_checkpoint), followed by
+ * the input_size bytes read in advance, then by the runs of cells :
+ * the index of the first cell and the number of cells of the run,
+ * as two uint64_t, then its cells. A run of 0 cells ends the file.
+ * key is the hash of the bytecode (see program_key), input_offset
+ * the offset of the input file, or UINT64_MAX if it can't seek.
+ *
+ * A task taking checkpoints is suspended every CHECKPOINT_SLICE loop
+ * iterations to see if one is due. The zero cells are left out of the
+ * runs, unless there are at most CHECKPOINT_GAP of them in a row.
+ */
+
+#define CHECKPOINT_MAGIC    "SBFK"
+#define CHECKPOINT_VERSION  2
+#define CHECKPOINT_SLICE    (1 << 20)
+#define CHECKPOINT_GAP      16
+
+typedef struct s_checkpoint
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t ip;
+    uint64_t pos;
+    uint64_t cells;
+    uint64_t input_size;
+    uint64_t input_offset;
+    uint64_t eof;
+}   t_checkpoint;
+
+// A task of the library, run with the options of its program
 
-// Macros used for the output buffer
+struct sbfi_task
+{
+    t_task task;
+};
 
-#define CHUNK_SIZE 1024
-#define PRINT_BUFFER(size) { write(1, &buffer, size); buffer_index = 0; }
+typedef struct s_job
+{
+    size_t program;
+    const char *input;
+    int input_fd;
+    int output_fd;
+    t_task task;
+}   t_job;
 
 /*
- * The magical computed goto : code[i] reads the next bytecode instruction,
+ * The jobs waiting for a worker thread are in the circular queue, from
+ * head, remaining is the number of jobs which aren't done yet, and
+ * failed the number of jobs which failed. A job suspended at the end of
+ * its time slice goes back to the queue.
+ */
+
+typedef struct s_batch
+{
+    t_program *programs;
+    size_t program_count;
+    size_t program_capacity;
+    t_job *jobs;
+    size_t size;
+    size_t capacity;
+    size_t *queue;
+    size_t head;
+    size_t queued;
+    size_t remaining;
+    size_t failed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    char *manifest;
+    const t_options *opt;
+}   t_batch;
+
+/*
+ * The data of the profiler : the source position and the execution
+ * count of each bytecode instruction, and a loop of the report.
+ * PROFILE_LOOPS is the number of loops in the report.
+ */
+
+#define PROFILE_LOOPS 20
+
+typedef struct s_profile
+{
+    size_t *pos;
+    uint64_t *count;
+    size_t size;
+}   t_profile;
+
+typedef struct s_loop
+{
+    size_t pos;
+    uint64_t cost;
+    uint64_t entries;
+    uint64_t iterations;
+    const char *folded;
+}   t_loop;
+
+/*
+ * The hardware counters of --perf-stats (see perf_open) : the file
+ * descriptor of each event, or -1 if it can't be counted, and the
+ * count and wall time of each phase of the run. phase is the one
+ * being measured, which started at start, or -1 if none is.
+ */
+
+#define PERF_EVENTS     5
+#define PERF_PHASES     3
+
+#define PERF_LOAD       0
+#define PERF_COMPILE    1
+#define PERF_RUN        2
+
+typedef struct s_perf
+{
+    int fd[PERF_EVENTS];
+    uint64_t count[PERF_PHASES][PERF_EVENTS];
+    double ms[PERF_PHASES];
+    struct timespec start;
+    int phase;
+}   t_perf;
+
+/*
+ * The verifier (see verify_program) compares each run of the bytecode
+ * with a run of the reference interpreter, which executes the source
+ * itself, one command at a time. t_reference is such a run : its
+ * status, its output, the position of its pointer, its size cells
+ * from the cell first (which is only negative with EXTEND), and the
+ * number of loop iterations it took. undefined is set when a run
+ * without any checking reaches a cell outside of the array, which
+ * the bytecode doesn't have to match.
+ *
+ * A run of the reference stops after VERIFY_STEPS loop iterations,
+ * unless --step-limit=N sets another limit, and after FUZZ_STEPS
+ * ones in the libFuzzer entry point (see fuzz.c), which has to be
+ * fast. The random programs of --fuzz=N nest their loops at most
+ * FUZZ_DEPTH deep.
+ */
+
+#define VERIFY_STEPS    1000000
+#define FUZZ_STEPS      10000
+#define FUZZ_DEPTH      3
+
+typedef struct s_reference
+{
+    int status;
+    int undefined;
+    uint64_t steps;
+    long pos;
+    uint64_t *cells;
+    long first;
+    size_t size;
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+}   t_reference;
+
+// The counts printed by the verifier once it's done
+
+typedef struct s_verify
+{
+    size_t programs;
+    size_t runs;
+    size_t skipped;
+    size_t failed;
+}   t_verify;
+
+/*
+ * The cell array used with guard pages : a region of reserved
+ * addresses, of which only [begin, end) can be accessed. ptr0 is
+ * the cell 0, size the initial number of cells. The bounds are
+ * volatile since guard_handler changes them behind exec_prog. jump
+ * and fault are where guard_handler jumps back when a fault stops the
+ * program, and which cell it reached. The output buffer of the run is
+ * kept here, so that exec_prog can still print it then.
+ */
+
+#define GUARD_RESERVE ((size_t)1 << (sizeof(void *) == 8 ? 32 : 26))
+
+typedef struct s_guard
+{
+    uint8_t *base;
+    size_t reserved;
+    size_t margin;
+    uint8_t *volatile begin;
+    uint8_t *volatile end;
+    uint8_t *ptr0;
+    size_t size;
+    size_t cell;
+    int memory;
+    struct sigaction old;
+    sigjmp_buf jump;
+    long fault;
+    char buffer[OUTPUT_SIZE];
+    volatile int buffer_index;
+}   t_guard;
+
+/*
+ * The magical computed goto : prog[i].op reads the next bytecode instruction,
  * which is then used as an index for instr, the array of label addresses,
  * and the address we get is accessed by the goto * (computed goto), which
  * allows to execute the program without conditional branches or function
  * call overheads. It's cool and fast *_*
+ *
+ * Direct threading goes one step further : the label address is
+ * already stored in prog[i].label, which saves the lookup in instr.
  */
 
-#define NEXT_INSTRUCTION MOVE_POINTER goto *(instr[(int)code[i]]);
+#if (PROFILE)
+    #define COUNT_INSTRUCTION ++profile.count[i];
+#else
+    #define COUNT_INSTRUCTION
+#endif
+
+/*
+ * A right bracket jumps back to its left bracket if the current cell
+ * isn't zero. Each jump taken counts one loop iteration against the
+ * step limit, so that an infinite loop is stopped (see exec.h). Only
+ * the jumps are counted, and the limit is almost never reached, so
+ * the check costs next to nothing.
+ */
+
+#define BACKWARD_JUMP if (*ptr) { i += prog[i].coeff; if (__builtin_expect(!--budget, 0)) goto limit; }
+
+// The work of a right bracket, done by the instructions fused with it
+
+#define RIGHT_BRACKET MOVE_POINTER COUNT_INSTRUCTION BACKWARD_JUMP
+
+#if (DISPATCH == DIRECT_THREADED)
+    #define NEXT_INSTRUCTION MOVE_POINTER COUNT_INSTRUCTION goto *(prog[i].label);
+#else
+    #define NEXT_INSTRUCTION MOVE_POINTER COUNT_INSTRUCTION goto *(instr[prog[i].op]);
+#endif
 
 #endif